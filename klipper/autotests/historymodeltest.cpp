@@ -22,6 +22,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../historyurlitem.h"
 
 #include <QAbstractItemModelTester>
+#include <QDirIterator>
+#include <QMimeData>
+#include <QTemporaryDir>
 #include <QtTest>
 
 class HistoryModelTest : public QObject
@@ -32,8 +35,11 @@ private Q_SLOTS:
     void testInsertRemove();
     void testClear();
     void testIndexOf();
+    void testIndexOfAfterReordering();
     void testType_data();
     void testType();
+    void testImageUuid();
+    void testImageCache();
 };
 
 void HistoryModelTest::testSetMaxSize()
@@ -218,6 +224,53 @@ void HistoryModelTest::testIndexOf()
     QVERIFY(!history->indexOf(fooUuid).isValid());
 }
 
+void HistoryModelTest::testIndexOfAfterReordering()
+{
+    QScopedPointer<HistoryModel> history(new HistoryModel(nullptr));
+    QScopedPointer<QAbstractItemModelTester> modelTest(new QAbstractItemModelTester(history.data()));
+    history->setMaxSize(10);
+
+    auto verifyIndexes = [&history]() {
+        for (int i = 0; i < history->rowCount(); ++i) {
+            const QByteArray uuid = history->index(i).data(Qt::UserRole+1).toByteArray();
+            QCOMPARE(history->indexOf(uuid).row(), i);
+        }
+    };
+
+    for (int i = 0; i < 12; ++i) {
+        history->insert(QSharedPointer<HistoryItem>(new HistoryStringItem(QString::number(i))));
+    }
+    QCOMPARE(history->rowCount(), 10);
+    verifyIndexes();
+    // the two oldest items got dropped
+    QVERIFY(!history->indexOf(QCryptographicHash::hash(QByteArrayLiteral("0"), QCryptographicHash::Sha1)).isValid());
+    QVERIFY(!history->indexOf(QCryptographicHash::hash(QByteArrayLiteral("1"), QCryptographicHash::Sha1)).isValid());
+
+    history->moveToTop(history->index(6).data(Qt::UserRole+1).toByteArray());
+    verifyIndexes();
+    history->moveTopToBack();
+    verifyIndexes();
+    history->moveBackToTop();
+    verifyIndexes();
+
+    // remove near the start and near the end
+    const QByteArray secondUuid = history->index(1).data(Qt::UserRole+1).toByteArray();
+    QVERIFY(history->remove(secondUuid));
+    QVERIFY(!history->indexOf(secondUuid).isValid());
+    verifyIndexes();
+    QVERIFY(history->removeRows(6, 2));
+    verifyIndexes();
+
+    // re-inserting an existing item moves it to the top
+    history->insert(QSharedPointer<HistoryItem>(new HistoryStringItem(QStringLiteral("5"))));
+    QCOMPARE(history->index(0).data().toString(), QStringLiteral("5"));
+    verifyIndexes();
+
+    history->setMaxSize(3);
+    QCOMPARE(history->rowCount(), 3);
+    verifyIndexes();
+}
+
 void HistoryModelTest::testType_data()
 {
     QTest::addColumn<HistoryItem*>("item");
@@ -244,5 +297,83 @@ void HistoryModelTest::testType()
     QCOMPARE(history->index(0).data(Qt::UserRole+2).value<HistoryItemType>(), expectedType);
 }
 
+void HistoryModelTest::testImageUuid()
+{
+    QScopedPointer<HistoryModel> history(new HistoryModel(nullptr));
+    QScopedPointer<QAbstractItemModelTester> modelTest(new QAbstractItemModelTester(history.data()));
+    history->setMaxSize(10);
+
+    QImage image(33, 17, QImage::Format_ARGB32);
+    image.fill(Qt::red);
+    history->insert(QSharedPointer<HistoryItem>(new HistoryImageItem(QPixmap::fromImage(image))));
+    QCOMPARE(history->rowCount(), 1);
+
+    // the same image again is deduplicated
+    history->insert(QSharedPointer<HistoryItem>(new HistoryImageItem(QPixmap::fromImage(image))));
+    QCOMPARE(history->rowCount(), 1);
+
+    // a single differing pixel is not
+    image.setPixel(32, 16, qRgba(0, 0, 255, 255));
+    history->insert(QSharedPointer<HistoryItem>(new HistoryImageItem(QPixmap::fromImage(image))));
+    QCOMPARE(history->rowCount(), 2);
+
+    // neither are the same pixels in a different shape
+    QImage transposed(17, 33, QImage::Format_ARGB32);
+    transposed.fill(Qt::red);
+    history->insert(QSharedPointer<HistoryItem>(new HistoryImageItem(QPixmap::fromImage(transposed))));
+    QCOMPARE(history->rowCount(), 3);
+}
+
+void HistoryModelTest::testImageCache()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    HistoryImageItem::setCacheDirectory(dir.path());
+    // images go into a directory of this process below the one set
+    auto fileCount = [&dir]() {
+        int count = 0;
+        QDirIterator it(dir.path(), QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            it.next();
+            ++count;
+        }
+        return count;
+    };
+
+    QScopedPointer<HistoryModel> history(new HistoryModel(nullptr));
+    history->setMaxSize(10);
+
+    QImage image(1024, 600, QImage::Format_ARGB32);
+    image.fill(Qt::red);
+    image.setPixel(1023, 599, qRgba(0, 0, 255, 255));
+    history->insert(QSharedPointer<HistoryItem>(new HistoryImageItem(QPixmap::fromImage(image))));
+
+    // only a thumbnail is kept in memory
+    const QPixmap thumbnail = history->index(0).data(Qt::DecorationRole).value<QPixmap>();
+    QCOMPARE(thumbnail.size(), QSize(512, 300));
+    // which is written in the background
+    QTRY_COMPARE(fileCount(), 1);
+
+    // while the full image is read back on demand
+    HistoryItemConstPtr item = history->index(0).data(Qt::UserRole).value<HistoryItemConstPtr>();
+    QCOMPARE(item->text(), QStringLiteral("▨ 1024x600 32bpp"));
+    QScopedPointer<QMimeData> data(item->mimeData());
+    QCOMPARE(qvariant_cast<QImage>(data->imageData()), image);
+
+    // small images aren't moved to disk
+    QImage small(16, 16, QImage::Format_ARGB32);
+    small.fill(Qt::green);
+    history->insert(QSharedPointer<HistoryItem>(new HistoryImageItem(QPixmap::fromImage(small))));
+    QCOMPARE(history->index(0).data(Qt::DecorationRole).value<QPixmap>().size(), QSize(16, 16));
+    QCOMPARE(fileCount(), 1);
+
+    // the file goes away with the last item referring to it
+    item.reset();
+    history->clear();
+    QTRY_COMPARE(fileCount(), 0);
+
+    HistoryImageItem::setCacheDirectory(QString());
+}
+
 QTEST_MAIN(HistoryModelTest)
 #include "historymodeltest.moc"
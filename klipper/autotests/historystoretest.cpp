@@ -0,0 +1,155 @@
+/********************************************************************
+This file is part of the KDE project.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+#include "../historystore.h"
+#include "../historystringitem.h"
+// Qt
+#include <QtTest>
+#include <QTemporaryDir>
+
+class HistoryStoreTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void init();
+    void testNoJournal();
+    void testRoundTrip();
+    void testIncrementalSave();
+    void testRemoveEverything();
+    void testDamagedTail();
+
+private:
+    static QVector<HistoryItemConstPtr> items(const QStringList &texts);
+    static QStringList load(HistoryStore &store, bool *ok = nullptr);
+
+    QScopedPointer<QTemporaryDir> m_dir;
+    QString m_fileName;
+};
+
+QVector<HistoryItemConstPtr> HistoryStoreTest::items(const QStringList &texts)
+{
+    QVector<HistoryItemConstPtr> items;
+    for (const QString &text : texts) {
+        items.append(HistoryItemConstPtr(new HistoryStringItem(text)));
+    }
+    return items;
+}
+
+QStringList HistoryStoreTest::load(HistoryStore &store, bool *ok)
+{
+    // items arrive oldest first, return them youngest first like the history
+    QStringList texts;
+    const bool loaded = store.load([&texts](HistoryItemPtr item) {
+        texts.prepend(item->text());
+    });
+    if (ok) {
+        *ok = loaded;
+    }
+    return texts;
+}
+
+void HistoryStoreTest::init()
+{
+    m_dir.reset(new QTemporaryDir);
+    QVERIFY(m_dir->isValid());
+    m_fileName = m_dir->filePath(QStringLiteral("history3.lst"));
+}
+
+void HistoryStoreTest::testNoJournal()
+{
+    HistoryStore store(m_fileName);
+    bool ok = true;
+    QVERIFY(load(store, &ok).isEmpty());
+    QVERIFY(!ok);
+}
+
+void HistoryStoreTest::testRoundTrip()
+{
+    const QStringList texts{QStringLiteral("foo"), QStringLiteral("bar"), QStringLiteral("foobar")};
+    HistoryStore store(m_fileName);
+    QVERIFY(store.save(items(texts)));
+
+    HistoryStore reopened(m_fileName);
+    bool ok = false;
+    QCOMPARE(load(reopened, &ok), texts);
+    QVERIFY(ok);
+}
+
+void HistoryStoreTest::testIncrementalSave()
+{
+    HistoryStore store(m_fileName);
+    QVERIFY(store.save(items({QStringLiteral("foo"), QStringLiteral("bar")})));
+    const qint64 initialSize = QFileInfo(m_fileName).size();
+
+    // adding an item appends to the file
+    QVERIFY(store.save(items({QStringLiteral("foobar"), QStringLiteral("foo"), QStringLiteral("bar")})));
+    QVERIFY(QFileInfo(m_fileName).size() > initialSize);
+
+    // reordering and removing are recorded too
+    const QStringList texts{QStringLiteral("bar"), QStringLiteral("foobar")};
+    QVERIFY(store.save(items(texts)));
+
+    HistoryStore reopened(m_fileName);
+    QCOMPARE(load(reopened), texts);
+
+    // saving the loaded state again doesn't change anything
+    const qint64 size = QFileInfo(m_fileName).size();
+    QVERIFY(reopened.save(items(texts)));
+    QCOMPARE(QFileInfo(m_fileName).size(), size);
+}
+
+void HistoryStoreTest::testRemoveEverything()
+{
+    HistoryStore store(m_fileName);
+    QVERIFY(store.save(items({QStringLiteral("secret")})));
+    QVERIFY(store.save(QVector<HistoryItemConstPtr>()));
+
+    // no trace of the item may be left in the file
+    const QString emptyFileName = m_dir->filePath(QStringLiteral("empty.lst"));
+    HistoryStore emptyStore(emptyFileName);
+    QVERIFY(emptyStore.compact(QVector<HistoryItemConstPtr>()));
+    QCOMPARE(QFileInfo(m_fileName).size(), QFileInfo(emptyFileName).size());
+
+    HistoryStore reopened(m_fileName);
+    bool ok = false;
+    QVERIFY(load(reopened, &ok).isEmpty());
+    QVERIFY(ok);
+}
+
+void HistoryStoreTest::testDamagedTail()
+{
+    const QStringList texts{QStringLiteral("foo"), QStringLiteral("bar")};
+    HistoryStore store(m_fileName);
+    QVERIFY(store.save(items(texts)));
+
+    // an interrupted append leaves a truncated record behind
+    QFile file(m_fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+    file.write(QByteArray("\x01\x00\x00\x10", 4));
+    file.close();
+
+    HistoryStore reopened(m_fileName);
+    QCOMPARE(load(reopened), texts);
+
+    // the next save rewrites the journal
+    const QStringList newTexts{QStringLiteral("foobar"), QStringLiteral("foo"), QStringLiteral("bar")};
+    QVERIFY(reopened.save(items(newTexts)));
+    HistoryStore again(m_fileName);
+    QCOMPARE(load(again), newTexts);
+}
+
+QTEST_MAIN(HistoryStoreTest)
+#include "historystoretest.moc"
@@ -21,55 +21,269 @@
 
 #include "historymodel.h"
 
+#include "klipper_debug.h"
 #include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QHash>
 #include <QIcon>
 #include <QMimeData>
+#include <QMutex>
+#include <QSaveFile>
+#include <QTemporaryDir>
+#include <QThreadPool>
 
 #include <KLocalizedString>
 
 namespace {
-    QByteArray compute_uuid(const QPixmap& data) {
-        QByteArray buffer;
-        QDataStream out(&buffer, QIODevice::WriteOnly);
-        out << data;
-        return QCryptographicHash::hash(buffer, QCryptographicHash::Sha1);
+    QByteArray compute_uuid(const QImage& image) {
+        // Hash the raw pixels rather than the serialized pixmap, which
+        // would mean encoding it as PNG first.
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        QByteArray header;
+        QDataStream stream(&header, QIODevice::WriteOnly);
+        stream << qint32(image.width()) << qint32(image.height()) << qint32(image.format());
+        hash.addData(header);
+        // Only hash the bytes that make up the pixels, the padding at the end
+        // of a scan line is undefined.
+        const int lineSize = (qint64(image.width()) * image.depth() + 7) / 8;
+        for (int y = 0; y < image.height(); ++y) {
+            hash.addData(reinterpret_cast<const char *>(image.constScanLine(y)), lineSize);
+        }
+        return hash.result();
     }
 
+    /**
+     * Images that fit into this are kept in memory as they are.
+     */
+    const int THUMBNAIL_SIZE = 512;
+
+    const quint32 SPILL_MAGIC = 0x4b4c4931; // "KLI1"
+    /**
+     * The pixels start at this offset into a spilled image file, after
+     * the header and some padding.
+     */
+    const qint64 SPILL_HEADER_SIZE = 64;
+
+    /**
+     * The directory large images are moved to, a directory of its own for
+     * this process below the configured cache directory, so that instances
+     * running in other sessions are left alone. It is removed on exit.
+     */
+    QString s_cacheDirectory;
+    QHash<QString, QSharedPointer<QTemporaryDir>> s_cacheDirectories;
+
+}
+
+/**
+ * The raw pixels of an image in the cache directory, named after the uuid
+ * of the image, so that all items holding the same image share a file.
+ * The file is removed with the last item referring to it.
+ *
+ * The file is written in the background. Until that's done, or if it
+ * fails, the image is kept in memory.
+ */
+class SpilledImage
+{
+public:
+    ~SpilledImage();
+
+    static QSharedPointer<SpilledImage> store(const QByteArray& uuid, const QImage& image);
+    /**
+     * Maps the file into memory and returns an image on top of it.
+     */
+    QImage load() const;
+
+private:
+    SpilledImage(const QByteArray& uuid, const QString& fileName, const QImage& image);
+
+    bool write(const QImage& image) const;
+
+    QByteArray m_uuid;
+    QString m_fileName;
+    mutable QMutex m_mutex;
+    QImage m_image; // until the file is written
+
+    // Items, and with them spilled images, may be released on the thread
+    // saving the history
+    static QMutex s_mutex;
+    static QHash<QByteArray, QWeakPointer<SpilledImage>> s_images;
+};
+
+QMutex SpilledImage::s_mutex;
+QHash<QByteArray, QWeakPointer<SpilledImage>> SpilledImage::s_images;
+
+SpilledImage::SpilledImage(const QByteArray& uuid, const QString& fileName, const QImage& image)
+    : m_uuid(uuid)
+    , m_fileName(fileName)
+    , m_image(image)
+{
+}
+
+SpilledImage::~SpilledImage()
+{
+    QFile::remove(m_fileName);
+    QMutexLocker lock(&s_mutex);
+    if (s_images.value(m_uuid).isNull()) {
+        s_images.remove(m_uuid);
+    }
+}
+
+QSharedPointer<SpilledImage> SpilledImage::store(const QByteArray& uuid, const QImage& image)
+{
+    QMutexLocker lock(&s_mutex);
+    QSharedPointer<SpilledImage> spilled = s_images.value(uuid).toStrongRef();
+    if (spilled) {
+        return spilled;
+    }
+
+    const QString fileName = s_cacheDirectory + QLatin1Char('/') + QString::fromLatin1(uuid.toHex());
+    spilled.reset(new SpilledImage(uuid, fileName, image));
+    s_images.insert(uuid, spilled);
+    lock.unlock();
+
+    // The job holds on to the image, so its file isn't removed before it's written
+    QThreadPool::globalInstance()->start([spilled] {
+        QMutexLocker lock(&spilled->m_mutex);
+        if (spilled->write(spilled->m_image)) {
+            spilled->m_image = QImage();
+        }
+    });
+    return spilled;
+}
+
+bool SpilledImage::write(const QImage& image) const
+{
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(KLIPPER_LOG) << "Failed to write image to" << m_fileName << ":" << file.errorString();
+        return false;
+    }
+    QByteArray header;
+    QDataStream stream(&header, QIODevice::WriteOnly);
+    stream << SPILL_MAGIC << qint32(image.width()) << qint32(image.height())
+           << qint32(image.format()) << qint32(image.bytesPerLine());
+    header.resize(SPILL_HEADER_SIZE);
+    file.write(header);
+    file.write(reinterpret_cast<const char *>(image.constBits()), image.sizeInBytes());
+    if (!file.commit()) {
+        qCWarning(KLIPPER_LOG) << "Failed to write image to" << m_fileName << ":" << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+QImage SpilledImage::load() const
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        if (!m_image.isNull()) {
+            return m_image;
+        }
+    }
+
+    QFile *file = new QFile(m_fileName);
+    if (file->open(QIODevice::ReadOnly)) {
+        QDataStream stream(file);
+        quint32 magic;
+        qint32 width, height, format, bytesPerLine;
+        stream >> magic >> width >> height >> format >> bytesPerLine;
+        const qint64 size = qint64(bytesPerLine) * height;
+        if (stream.status() == QDataStream::Ok && magic == SPILL_MAGIC
+                && file->size() >= SPILL_HEADER_SIZE + size) {
+            if (const uchar *bits = file->map(SPILL_HEADER_SIZE, size)) {
+                // Pixels are only paged in as they are read. The mapping
+                // lives as long as the image and its shallow copies, while
+                // modifying the image detaches from it.
+                return QImage(bits, width, height, bytesPerLine, QImage::Format(format),
+                              [](void *file) { delete static_cast<QFile *>(file); }, file);
+            }
+        }
+    }
+    qCWarning(KLIPPER_LOG) << "Failed to read image from" << m_fileName;
+    delete file;
+    return QImage();
 }
 
 HistoryImageItem::HistoryImageItem( const QPixmap& data )
-    : HistoryItem(compute_uuid(data))
-    , m_data( data )
+    : HistoryImageItem( data, data.toImage() )
+{
+}
+
+HistoryImageItem::HistoryImageItem( const QPixmap& data, const QImage& image )
+    : HistoryItem(compute_uuid(image))
+    , m_size( data.size() )
+    , m_depth( data.depth() )
 {
+    if (!s_cacheDirectory.isEmpty() && (data.width() > THUMBNAIL_SIZE || data.height() > THUMBNAIL_SIZE)) {
+        m_spilled = SpilledImage::store(uuid(), image);
+    }
+    if (m_spilled) {
+        m_thumbnail = data.scaled(THUMBNAIL_SIZE, THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    } else {
+        m_data = data;
+    }
 }
 
+HistoryImageItem::~HistoryImageItem() = default;
+
 QString HistoryImageItem::text() const {
     if (m_text.isNull()) {
         m_text =
             QStringLiteral("▨ ") +
             i18n("%1x%2 %3bpp",
-                 m_data.width(),
-                 m_data.height(),
-                 m_data.depth());
+                 m_size.width(),
+                 m_size.height(),
+                 m_depth);
     }
     return m_text;
 }
 
 /* virtual */
 void HistoryImageItem::write( QDataStream& stream ) const {
-    stream << QStringLiteral( "image" ) << m_data;
+    // A pixmap is streamed as its image, so this doesn't change the format
+    stream << QStringLiteral( "image" ) << fullImage();
 }
 
 QMimeData* HistoryImageItem::mimeData() const
 {
     QMimeData *data = new QMimeData();
-    data->setImageData(m_data.toImage());
+    data->setImageData(fullImage());
     return data;
 }
 
+QImage HistoryImageItem::fullImage() const
+{
+    if (m_spilled) {
+        return m_spilled->load();
+    }
+    return m_data.toImage();
+}
+
+void HistoryImageItem::setCacheDirectory(const QString& path)
+{
+    if (path.isEmpty()) {
+        s_cacheDirectory.clear();
+        return;
+    }
+
+    // Keep the directories used before, images in them may still be in use
+    const QString basePath = QDir::cleanPath(path);
+    QSharedPointer<QTemporaryDir> &dir = s_cacheDirectories[basePath];
+    if (!dir) {
+        QDir().mkpath(basePath);
+        dir.reset(new QTemporaryDir(basePath + QLatin1String("/klipper-XXXXXX")));
+    }
+    s_cacheDirectory = dir->isValid() ? dir->path() : QString();
+    if (!dir->isValid()) {
+        qCWarning(KLIPPER_LOG) << "Failed to create image cache directory in" << basePath << ":" << dir->errorString();
+    }
+}
+
 const QPixmap& HistoryImageItem::image() const {
     if (m_model->displayImages()) {
-        return m_data;
+        return m_spilled ? m_thumbnail : m_data;
     }
     static QPixmap imageIcon(
         QIcon::fromTheme(QStringLiteral("view-preview")).pixmap(QSize(48, 48))
@@ -22,14 +22,20 @@
 
 #include "historyitem.h"
 
+class SpilledImage;
+
 /**
  * A image entry in the clipboard history.
+ *
+ * If a cache directory is set, images larger than a thumbnail are written
+ * there and only the thumbnail is kept in memory. The full image is mapped
+ * back in from disk when it's needed, e.g. for pasting.
  */
 class HistoryImageItem : public HistoryItem
 {
 public:
     explicit HistoryImageItem( const QPixmap& data );
-    ~HistoryImageItem() override {}
+    ~HistoryImageItem() override;
     QString text() const override;
     bool operator==( const HistoryItem& rhs) const override {
         if ( const HistoryImageItem* casted_rhs = dynamic_cast<const HistoryImageItem*>( &rhs ) ) {
@@ -37,16 +43,42 @@ public:
         }
         return false;
     }
+    /**
+     * The image for display, which is only a thumbnail if the full image
+     * has been moved to disk.
+     */
     const QPixmap& image() const override;
     QMimeData* mimeData() const override;
 
     void write( QDataStream& stream ) const override;
 
+    /**
+     * Returns the full image, reading it from disk if needed.
+     */
+    QImage fullImage() const;
+
+    /**
+     * Sets the directory large images are moved to. They are written to a
+     * directory of this process inside it, which is removed on exit. An
+     * empty @p path keeps images created from now on in memory, which is
+     * the default.
+     */
+    static void setCacheDirectory(const QString& path);
+
 private:
+    HistoryImageItem( const QPixmap& data, const QImage& image );
+
+    /**
+     * The full image, unless it's on disk
+     */
+    QPixmap m_data;
     /**
-     *
+     * Scaled down m_data, if the full image is on disk
      */
-    const QPixmap m_data;
+    QPixmap m_thumbnail;
+    QSharedPointer<SpilledImage> m_spilled;
+    QSize m_size;
+    int m_depth;
     /**
      * Cache for m_data's string representation
      */
@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 HistoryModel::HistoryModel(QObject *parent)
     : QAbstractListModel(parent)
+    , m_rowOffset(0)
     , m_maxSize(0)
     , m_displayImages(true)
     , m_mutex(QMutex::Recursive)
@@ -40,6 +41,8 @@ void HistoryModel::clear()
     QMutexLocker lock(&m_mutex);
     beginResetModel();
     m_items.clear();
+    m_rowKeys.clear();
+    m_rowOffset = 0;
     endResetModel();
 }
 
@@ -109,8 +112,16 @@ bool HistoryModel::removeRows(int row, int count, const QModelIndex &parent)
     QMutexLocker lock(&m_mutex);
     beginRemoveRows(QModelIndex(), row, row + count - 1);
     for (int i = 0; i < count; ++i) {
+        m_rowKeys.remove(m_items.at(row)->uuid());
         m_items.removeAt(row);
     }
+    // re-index whichever side of the removed rows is smaller
+    if (row < m_items.count() - row) {
+        m_rowOffset += count;
+        shiftRows(0, row - 1, count);
+    } else {
+        shiftRows(row, m_items.count() - 1, -count);
+    }
     endRemoveRows();
     return true;
 }
@@ -126,12 +137,18 @@ bool HistoryModel::remove(const QByteArray &uuid)
 
 QModelIndex HistoryModel::indexOf(const QByteArray &uuid) const
 {
-    for (int i = 0; i < m_items.count(); ++i) {
-        if (m_items.at(i)->uuid() == uuid) {
-            return index(i);
-        }
+    const auto it = m_rowKeys.constFind(uuid);
+    if (it == m_rowKeys.constEnd()) {
+        return QModelIndex();
+    }
+    return index(it.value() - m_rowOffset);
+}
+
+void HistoryModel::shiftRows(int first, int last, int delta)
+{
+    for (int i = first; i <= last; ++i) {
+        m_rowKeys[m_items.at(i)->uuid()] += delta;
     }
-    return QModelIndex();
 }
 
 QModelIndex HistoryModel::indexOf(const HistoryItem *item) const
@@ -162,6 +179,7 @@ void HistoryModel::insert(QSharedPointer<HistoryItem> item)
             return;
         }
         beginRemoveRows(QModelIndex(), m_items.count() - 1, m_items.count() - 1);
+        m_rowKeys.remove(m_items.last()->uuid());
         m_items.removeLast();
         endRemoveRows();
     }
@@ -169,6 +187,9 @@ void HistoryModel::insert(QSharedPointer<HistoryItem> item)
     beginInsertRows(QModelIndex(), 0, 0);
     item->setModel(this);
     m_items.prepend(item);
+    // all rows move down by one, the new item takes row 0
+    --m_rowOffset;
+    m_rowKeys.insert(item->uuid(), m_rowOffset);
     endInsertRows();
 }
 
@@ -188,6 +209,8 @@ void HistoryModel::moveToTop(int row)
     }
     QMutexLocker lock(&m_mutex);
     beginMoveRows(QModelIndex(), row, row, QModelIndex(), 0);
+    shiftRows(0, row - 1, 1);
+    m_rowKeys.insert(m_items.at(row)->uuid(), m_rowOffset);
     m_items.move(row, 0);
     endMoveRows();
 }
@@ -201,6 +224,9 @@ void HistoryModel::moveTopToBack()
     beginMoveRows(QModelIndex(), 0, 0, QModelIndex(), m_items.count());
     auto item = m_items.takeFirst();
     m_items.append(item);
+    // all rows move up by one, the former first item takes the last row
+    ++m_rowOffset;
+    m_rowKeys.insert(item->uuid(), m_items.count() - 1 + m_rowOffset);
     endMoveRows();
 }
 
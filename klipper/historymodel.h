@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define KLIPPER_HISTORYMODEL_H
 
 #include <QAbstractListModel>
+#include <QHash>
 #include <QMutex>
 
 class HistoryItem;
@@ -65,7 +66,15 @@ public:
 
 private:
     void moveToTop(int row);
+    void shiftRows(int first, int last, int delta);
     QList<QSharedPointer<HistoryItem>> m_items;
+    /**
+     * Index of the items by uuid. The row of an item is its key minus
+     * m_rowOffset, so that prepending an item or moving the first one to
+     * the back does not need to touch the keys of all others.
+     */
+    QHash<QByteArray, int> m_rowKeys;
+    int m_rowOffset;
     int m_maxSize;
     bool m_displayImages;
     QMutex m_mutex;
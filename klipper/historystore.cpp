@@ -0,0 +1,307 @@
+/* This file is part of the KDE project
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+#include "historystore.h"
+
+#include <zlib.h>
+
+#include "klipper_debug.h"
+#include <QDataStream>
+#include <QFile>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QSet>
+
+static const quint32 JOURNAL_MAGIC = 0x4b4c4a31; // "KLJ1"
+static const quint32 JOURNAL_VERSION = 1;
+static const qint64 JOURNAL_HEADER_SIZE = 2 * sizeof(quint32);
+static const QDataStream::Version JOURNAL_STREAM_VERSION = QDataStream::Qt_5_15;
+
+// Don't bother rewriting the file for less garbage than this.
+static const qint64 COMPACTION_MIN_DEAD_BYTES = 256 * 1024;
+
+static quint32 checksum(const QByteArray &data)
+{
+    return crc32(0, reinterpret_cast<const unsigned char *>(data.constData()), data.size());
+}
+
+HistoryStore::HistoryStore(const QString &fileName)
+    : m_fileName(fileName)
+    , m_valid(false)
+    , m_orderRecordSize(0)
+    , m_deadBytes(0)
+{
+}
+
+bool HistoryStore::load(const std::function<void(HistoryItemPtr)> &insert)
+{
+    QMutexLocker lock(&m_mutex);
+    m_valid = false;
+    m_itemRecordSizes.clear();
+    m_order.clear();
+    m_orderRecordSize = 0;
+    m_deadBytes = 0;
+
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(JOURNAL_STREAM_VERSION);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != JOURNAL_MAGIC || version != JOURNAL_VERSION) {
+        qCWarning(KLIPPER_LOG) << "Failed to load history journal" << m_fileName << ": Unknown format";
+        return false;
+    }
+
+    // First pass: find the live record of every item and the latest order,
+    // holding a single record in memory at a time.
+    QHash<QByteArray, qint64> itemOffsets;
+    qint64 recordBytes = 0;
+    bool damaged = false;
+    while (!stream.atEnd()) {
+        const qint64 offset = file.pos();
+        quint8 type;
+        QByteArray payload;
+        quint32 crc;
+        stream >> type >> payload >> crc;
+        if (stream.status() != QDataStream::Ok || checksum(payload) != crc) {
+            damaged = true;
+            break;
+        }
+        const qint64 size = file.pos() - offset;
+        recordBytes += size;
+
+        QDataStream payloadStream(payload);
+        payloadStream.setVersion(JOURNAL_STREAM_VERSION);
+        QByteArray uuid;
+        switch (type) {
+        case ItemRecord:
+            payloadStream >> uuid;
+            itemOffsets.insert(uuid, offset);
+            m_itemRecordSizes.insert(uuid, size);
+            break;
+        case RemovalRecord:
+            payloadStream >> uuid;
+            itemOffsets.remove(uuid);
+            m_itemRecordSizes.remove(uuid);
+            break;
+        case OrderRecord:
+            payloadStream >> m_order;
+            m_orderRecordSize = size;
+            break;
+        default:
+            damaged = true;
+            break;
+        }
+        if (damaged) {
+            break;
+        }
+    }
+    if (damaged) {
+        qCWarning(KLIPPER_LOG) << "History journal" << m_fileName << "is damaged, ignoring records after offset" << (JOURNAL_HEADER_SIZE + recordBytes);
+    }
+
+    qint64 liveBytes = m_orderRecordSize;
+    for (auto it = m_itemRecordSizes.constBegin(); it != m_itemRecordSizes.constEnd(); ++it) {
+        liveBytes += it.value();
+    }
+    m_deadBytes = recordBytes - liveBytes;
+
+    // Second pass: create the items in the recorded order, oldest first.
+    stream.resetStatus();
+    QVector<QByteArray> order;
+    order.reserve(m_order.size());
+    for (auto it = m_order.crbegin(); it != m_order.crend(); ++it) {
+        const auto offsetIt = itemOffsets.constFind(*it);
+        if (offsetIt == itemOffsets.constEnd() || !file.seek(offsetIt.value())) {
+            continue;
+        }
+        quint8 type;
+        QByteArray payload;
+        quint32 crc;
+        stream >> type >> payload >> crc;
+
+        QDataStream payloadStream(payload);
+        payloadStream.setVersion(JOURNAL_STREAM_VERSION);
+        QByteArray uuid;
+        payloadStream >> uuid;
+        HistoryItemPtr item = HistoryItem::create(payloadStream);
+        if (item.isNull()) {
+            continue;
+        }
+        order.prepend(*it);
+        insert(item);
+    }
+    m_order = order;
+
+    // Records can only be appended to a journal known to be intact; otherwise
+    // the next save rewrites it.
+    m_valid = !damaged;
+    return true;
+}
+
+bool HistoryStore::save(const QVector<HistoryItemConstPtr> &items)
+{
+    QMutexLocker lock(&m_mutex);
+
+    // An empty history is written out in full so that no trace of the
+    // removed items is left on disk.
+    if (!m_valid || items.isEmpty()) {
+        return compactLocked(items);
+    }
+
+    QVector<QByteArray> order;
+    order.reserve(items.size());
+    QSet<QByteArray> uuids;
+    uuids.reserve(items.size());
+    for (const HistoryItemConstPtr &item : items) {
+        order.append(item->uuid());
+        uuids.insert(item->uuid());
+    }
+
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCWarning(KLIPPER_LOG) << "Failed to open history journal" << m_fileName << ":" << file.errorString();
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(JOURNAL_STREAM_VERSION);
+
+    for (auto it = m_itemRecordSizes.begin(); it != m_itemRecordSizes.end();) {
+        if (uuids.contains(it.key())) {
+            ++it;
+            continue;
+        }
+        QByteArray payload;
+        QDataStream payloadStream(&payload, QIODevice::WriteOnly);
+        payloadStream.setVersion(JOURNAL_STREAM_VERSION);
+        payloadStream << it.key();
+        // Both the item record and its tombstone go away on compaction.
+        m_deadBytes += it.value() + writeRecord(stream, RemovalRecord, payload);
+        it = m_itemRecordSizes.erase(it);
+    }
+
+    for (const HistoryItemConstPtr &item : items) {
+        if (!m_itemRecordSizes.contains(item->uuid())) {
+            m_itemRecordSizes.insert(item->uuid(), writeRecord(stream, ItemRecord, itemPayload(item.data())));
+        }
+    }
+
+    if (order != m_order) {
+        m_deadBytes += m_orderRecordSize;
+        m_orderRecordSize = writeRecord(stream, OrderRecord, orderPayload(order));
+        m_order = order;
+    }
+
+    if (stream.status() != QDataStream::Ok || !file.flush()) {
+        qCWarning(KLIPPER_LOG) << "Failed to append to history journal" << m_fileName << ":" << file.errorString();
+        // The tail of the file may be garbage now, rewrite it next time.
+        m_valid = false;
+        return false;
+    }
+    file.close();
+
+    if (compactionDue()) {
+        return compactLocked(items);
+    }
+    return true;
+}
+
+bool HistoryStore::compact(const QVector<HistoryItemConstPtr> &items)
+{
+    QMutexLocker lock(&m_mutex);
+    return compactLocked(items);
+}
+
+bool HistoryStore::compactLocked(const QVector<HistoryItemConstPtr> &items)
+{
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(KLIPPER_LOG) << "Failed to write history journal" << m_fileName << ":" << file.errorString();
+        m_valid = false;
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(JOURNAL_STREAM_VERSION);
+    stream << JOURNAL_MAGIC << JOURNAL_VERSION;
+
+    QHash<QByteArray, qint64> itemRecordSizes;
+    itemRecordSizes.reserve(items.size());
+    QVector<QByteArray> order;
+    order.reserve(items.size());
+    for (const HistoryItemConstPtr &item : items) {
+        if (itemRecordSizes.contains(item->uuid())) {
+            continue;
+        }
+        itemRecordSizes.insert(item->uuid(), writeRecord(stream, ItemRecord, itemPayload(item.data())));
+        order.append(item->uuid());
+    }
+    const qint64 orderRecordSize = writeRecord(stream, OrderRecord, orderPayload(order));
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qCWarning(KLIPPER_LOG) << "Failed to write history journal" << m_fileName << ":" << file.errorString();
+        m_valid = false;
+        return false;
+    }
+
+    m_itemRecordSizes = itemRecordSizes;
+    m_order = order;
+    m_orderRecordSize = orderRecordSize;
+    m_deadBytes = 0;
+    m_valid = true;
+    return true;
+}
+
+qint64 HistoryStore::writeRecord(QDataStream &stream, RecordType type, const QByteArray &payload)
+{
+    stream << quint8(type) << payload << checksum(payload);
+    return sizeof(quint8) + sizeof(quint32) + payload.size() + sizeof(quint32);
+}
+
+QByteArray HistoryStore::itemPayload(const HistoryItem *item)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(JOURNAL_STREAM_VERSION);
+    stream << item->uuid() << item;
+    return payload;
+}
+
+QByteArray HistoryStore::orderPayload(const QVector<QByteArray> &order)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(JOURNAL_STREAM_VERSION);
+    stream << order;
+    return payload;
+}
+
+bool HistoryStore::compactionDue() const
+{
+    if (m_deadBytes < COMPACTION_MIN_DEAD_BYTES) {
+        return false;
+    }
+    qint64 liveBytes = m_orderRecordSize;
+    for (auto it = m_itemRecordSizes.constBegin(); it != m_itemRecordSizes.constEnd(); ++it) {
+        liveBytes += it.value();
+    }
+    return m_deadBytes > liveBytes;
+}
@@ -0,0 +1,103 @@
+/* This file is part of the KDE project
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+#include "historyitem.h"
+
+class QDataStream;
+
+/**
+ * Journaled on-disk storage of the clipboard history.
+ *
+ * The file is a sequence of records, each protected by its own checksum:
+ * item records holding one serialized HistoryItem, removal records
+ * tombstoning an earlier item record, and order records listing the
+ * uuids of the history, youngest first. Saving only appends records for
+ * what changed since the last load or save; once the dead records
+ * outweigh the live ones, the file is rewritten from scratch.
+ *
+ * All methods can be called from any thread, they are serialized.
+ */
+class HistoryStore
+{
+public:
+    explicit HistoryStore(const QString &fileName);
+
+    QString fileName() const {
+        return m_fileName;
+    }
+
+    /**
+     * Replays the journal and passes the stored items to @p insert,
+     * oldest first. Items are read from the file one at a time.
+     * A damaged tail, e.g. from an interrupted write, is ignored.
+     * @returns false if there is no readable journal
+     */
+    bool load(const std::function<void(HistoryItemPtr)> &insert);
+
+    /**
+     * Appends the records bringing the journal in line with @p items,
+     * youngest first, compacting the file if it is due.
+     */
+    bool save(const QVector<HistoryItemConstPtr> &items);
+
+    /**
+     * Rewrites the journal to hold just @p items, youngest first,
+     * dropping everything removed earlier from disk.
+     */
+    bool compact(const QVector<HistoryItemConstPtr> &items);
+
+private:
+    enum RecordType : quint8 {
+        ItemRecord = 1,
+        RemovalRecord = 2,
+        OrderRecord = 3,
+    };
+
+    bool compactLocked(const QVector<HistoryItemConstPtr> &items);
+    static qint64 writeRecord(QDataStream &stream, RecordType type, const QByteArray &payload);
+    static QByteArray itemPayload(const HistoryItem *item);
+    static QByteArray orderPayload(const QVector<QByteArray> &order);
+    bool compactionDue() const;
+
+    QString m_fileName;
+    QMutex m_mutex;
+    /**
+     * Whether the file is known to match the members below, i.e. whether
+     * records can be appended to it.
+     */
+    bool m_valid;
+    /**
+     * Size of the live item record for each stored uuid.
+     */
+    QHash<QByteArray, qint64> m_itemRecordSizes;
+    QVector<QByteArray> m_order;
+    qint64 m_orderRecordSize;
+    qint64 m_deadBytes;
+};
+
+#endif
@@ -31,7 +31,6 @@
 #include <QMenu>
 #include <QMessageBox>
 #include <QDBusConnection>
-#include <QSaveFile>
 #include <QtConcurrent>
 
 #include <KGlobalAccel>
@@ -45,8 +44,10 @@
 #include "configdialog.h"
 #include "klippersettings.h"
 #include "history.h"
+#include "historyimageitem.h"
 #include "historyitem.h"
 #include "historymodel.h"
+#include "historystore.h"
 #include "historystringitem.h"
 #include "klipperpopup.h"
 
@@ -99,6 +100,8 @@ Klipper::Klipper(QObject* parent, const KSharedConfigPtr& config, KlipperMode mo
     QDBusConnection::sessionBus().registerService(QStringLiteral("org.kde.klipper"));
     QDBusConnection::sessionBus().registerObject(QStringLiteral("/klipper"), this, QDBusConnection::ExportScriptableSlots);
 
+    m_savePool.setMaxThreadCount(1);
+
     updateTimestamp(); // read initial X user time
     m_clip = SystemClipboard::instance();
 
@@ -111,6 +114,9 @@ Klipper::Klipper(QObject* parent, const KSharedConfigPtr& config, KlipperMode mo
 
 
     m_history = new History( this );
+    // don't use "appdata", klipper is also a kicker applet
+    m_historyStore.reset(new HistoryStore(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+                                          + QLatin1String("/klipper/history3.lst")));
     m_popup = new KlipperPopup(m_history);
     m_popup->setShowHelp(m_mode == KlipperMode::Standalone);
     connect(m_history, &History::changed, this, &Klipper::slotHistoryChanged);
@@ -239,6 +245,7 @@ Klipper::Klipper(QObject* parent, const KSharedConfigPtr& config, KlipperMode mo
 
 Klipper::~Klipper()
 {
+    m_savePool.waitForDone();
     delete m_myURLGrabber;
 }
 
@@ -324,6 +331,11 @@ void Klipper::loadSettings()
     setURLGrabberEnabled(m_bURLGrabber);
     history()->setMaxSize( KlipperSettings::maxClipItems() );
     history()->model()->setDisplayImages(!m_bIgnoreImages);
+    // Large images are only moved out of memory if the history may be
+    // stored on disk anyway.
+    HistoryImageItem::setCacheDirectory(m_bKeepContents
+        ? QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/klipper/images")
+        : QString());
 
     // Convert 4.3 settings
     if (KlipperSettings::synchronize() != 3) {
@@ -348,7 +360,11 @@ void Klipper::loadSettings()
         m_saveFileTimer->setInterval(5000);
         connect(m_saveFileTimer, &QTimer::timeout, this,
             [this] {
-                QtConcurrent::run(this, &Klipper::saveHistory, false);
+                // Take the items on this thread, only the writing is done in the background
+                const QVector<HistoryItemConstPtr> items = historyItems();
+                QtConcurrent::run(&m_savePool, [this, items] {
+                    writeHistory(items, false);
+                });
             }
         );
         connect(m_history, &History::changed, m_saveFileTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
@@ -375,6 +391,28 @@ void Klipper::showPopupMenu( QMenu* menu )
 }
 
 bool Klipper::loadHistory() {
+    // Items are streamed in oldest first, as they are read from the journal.
+    bool cleared = false;
+    bool loaded = m_historyStore->load([this, &cleared](HistoryItemPtr item) {
+        if (!cleared) {
+            history()->slotClear();
+            cleared = true;
+        }
+        history()->forceInsert(item);
+    });
+
+    if (!loaded) {
+        loaded = loadLegacyHistory();
+    }
+
+    if ( loaded && !history()->empty() ) {
+        setClipboard( *history()->first(), Clipboard | Selection );
+    }
+
+    return loaded;
+}
+
+bool Klipper::loadLegacyHistory() {
     static const char failed_load_warning[] =
         "Failed to load history resource. Clipboard history cannot be read.";
     // don't use "appdata", klipper is also a kicker applet
@@ -427,58 +465,48 @@ bool Klipper::loadHistory() {
         history()->forceInsert(*it);
     }
 
-    if ( !history()->empty() ) {
-        setClipboard( *history()->first(), Clipboard | Selection );
-    }
-
     return true;
 }
 
 void Klipper::saveHistory(bool empty) {
+    // Background saves hold older snapshots, they must not overwrite this one
+    m_savePool.waitForDone();
+    writeHistory(empty ? QVector<HistoryItemConstPtr>() : historyItems(), empty);
+}
+
+QVector<HistoryItemConstPtr> Klipper::historyItems() const
+{
     QMutexLocker lock(m_history->model()->mutex());
+    const HistoryModel *model = m_history->model();
+    QVector<HistoryItemConstPtr> items;
+    items.reserve(model->rowCount());
+    for (int i = 0; i < model->rowCount(); ++i) {
+        items.append(model->index(i).data(Qt::UserRole).value<HistoryItemConstPtr>());
+    }
+    return items;
+}
+
+void Klipper::writeHistory(const QVector<HistoryItemConstPtr> &items, bool empty)
+{
     static const char failed_save_warning[] =
         "Failed to save history. Clipboard history cannot be saved.";
     // don't use "appdata", klipper is also a kicker applet
-    QString history_file_name(QStandardPaths::locate(QStandardPaths::GenericDataLocation,
-                                                     QStringLiteral("klipper/history2.lst")));
-    if ( history_file_name.isNull() || history_file_name.isEmpty() ) {
-        // try creating the file
-        QDir dir(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation));
-        if (!dir.mkpath(QStringLiteral("klipper"))) {
-            qCWarning(KLIPPER_LOG) << failed_save_warning ;
-            return;
-        }
-        history_file_name = dir.absoluteFilePath(QStringLiteral("klipper/history2.lst"));
-    }
-    if ( history_file_name.isNull() || history_file_name.isEmpty() ) {
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation));
+    if (!dir.mkpath(QStringLiteral("klipper"))) {
         qCWarning(KLIPPER_LOG) << failed_save_warning ;
         return;
     }
-    QSaveFile history_file( history_file_name );
-    if (!history_file.open(QIODevice::WriteOnly)) {
+
+    // Only what changed since the last save gets appended to the journal,
+    // unless everything is to be dropped from disk.
+    const bool saved = empty ? m_historyStore->compact(items) : m_historyStore->save(items);
+    if (!saved) {
         qCWarning(KLIPPER_LOG) << failed_save_warning ;
         return;
     }
-    QByteArray data;
-    QDataStream history_stream( &data, QIODevice::WriteOnly );
-    history_stream << KLIPPER_VERSION_STRING; // const char*
-
-    if (!empty) {
-        HistoryItemConstPtr item = history()->first();
-        if (item) {
-            do {
-                history_stream << item.data();
-                item = HistoryItemConstPtr(history()->find(item->next_uuid()));
-            } while (item != history()->first());
-        }
-    }
 
-    quint32 crc = crc32( 0, reinterpret_cast<unsigned char *>( data.data() ), data.size() );
-    QDataStream ds ( &history_file );
-    ds << crc << data;
-    if (!history_file.commit()) {
-        qCWarning(KLIPPER_LOG) << failed_save_warning ;
-    }
+    // The journal supersedes the history file of earlier versions.
+    QFile::remove(dir.absoluteFilePath(QStringLiteral("klipper/history2.lst")));
 }
 
 // save session on shutdown. Don't simply use the c'tor, as that may not be called.
@@ -27,7 +27,11 @@
 #include <QTimer>
 #include <QClipboard>
 #include <QPointer>
+#include <QScopedPointer>
+#include <QThreadPool>
+#include <QVector>
 
+#include "historyitem.h"
 #include "urlgrabber.h"
 
 class KToggleAction;
@@ -36,6 +40,7 @@ class KlipperPopup;
 class URLGrabber;
 class QTime;
 class History;
+class HistoryStore;
 class QAction;
 class QMenu;
 class QMimeData;
@@ -112,12 +117,29 @@ protected:
      */
     bool loadHistory();
 
+    /**
+     * Loads history from the pre-journal history file.
+     */
+    bool loadLegacyHistory();
+
     /**
      * Save history to disk
      * @param empty save empty history instead of actual history
      */
     void saveHistory(bool empty = false);
 
+    /**
+     * The items currently in the history, youngest first.
+     * Must be called on the GUI thread.
+     */
+    QVector<HistoryItemConstPtr> historyItems() const;
+
+    /**
+     * Writes @p items to disk, can be called from any thread.
+     * @param empty drop everything stored so far instead of appending
+     */
+    void writeHistory(const QVector<HistoryItemConstPtr> &items, bool empty);
+
     /**
      * Check data in clipboard, and if it passes these checks,
      * store the data in the clipboard history.
@@ -170,6 +192,7 @@ private:
     QElapsedTimer m_showTimer;
 
     History* m_history;
+    QScopedPointer<HistoryStore> m_historyStore;
     KlipperPopup *m_popup;
     int m_overflowCounter;
 
@@ -215,6 +238,8 @@ private:
     KActionCollection* m_collection;
     KlipperMode m_mode;
     QTimer *m_saveFileTimer = nullptr;
+    // Runs background saves one at a time, in the order they were taken
+    QThreadPool m_savePool;
     QPointer<KNotification> m_notification;
 };
 
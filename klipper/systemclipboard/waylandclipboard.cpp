@@ -19,22 +19,83 @@
 
 #include "waylandclipboard.h"
 
-#include <QFile>
 #include <QFutureWatcher>
 #include <QPointer>
+#include <QSet>
 #include <QDebug>
 #include <QGuiApplication>
+#include <QImage>
+#include <QImageReader>
+#include <QSocketNotifier>
+#include <QTimer>
 
 #include <QtWaylandClient/QWaylandClientExtension>
 
 #include <qpa/qplatformnativeinterface.h>
 
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "qwayland-wlr-data-control-unstable-v1.h"
 
 #include <sys/select.h>
 
+// Data of a single MIME type larger than this is dropped.
+static const int MAX_TRANSFER_SIZE = 64 * 1024 * 1024;
+// Sources that haven't finished writing by then are given up on.
+static const int TRANSFER_TIMEOUT = 5000;
+
+static const QString s_qtImageFormat = QStringLiteral("application/x-qt-image");
+
+// The offered image type QMimeData::imageData() is decoded from, PNG if
+// possible as it is lossless and what most clients offer.
+static QString imageFormat(const QStringList &offered)
+{
+    const QString png = QStringLiteral("image/png");
+    if (offered.contains(png)) {
+        return png;
+    }
+
+    static const QList<QByteArray> readable = QImageReader::supportedMimeTypes();
+    for (const QString &format : offered) {
+        if (format.startsWith(QLatin1String("image/")) && readable.contains(format.toLatin1())) {
+            return format;
+        }
+    }
+    return QString();
+}
+
+// The formats read by Klipper and KUrlMimeData when handling a new selection,
+// in order of preference within each group. Of every group only the first
+// format offered is fetched.
+static QStringList prefetchedFormats(const QStringList &offered)
+{
+    static const QVector<QStringList> groups = {
+        {QStringLiteral("x-kde-passwordManagerHint")},
+        {QStringLiteral("application/x-kde4-urilist"), QStringLiteral("text/uri-list")},
+        {QStringLiteral("application/x-kio-metadata")},
+        {QStringLiteral("application/x-kde-cutselection")},
+        {QStringLiteral("text/plain;charset=utf-8"), QStringLiteral("text/plain")},
+    };
+
+    QStringList formats;
+    for (const QStringList &group : groups) {
+        for (const QString &format : group) {
+            if (offered.contains(format)) {
+                formats << format;
+                break;
+            }
+        }
+    }
+
+    const QString image = imageFormat(offered);
+    if (!image.isEmpty()) {
+        formats << image;
+    }
+    return formats;
+}
+
 class DataControlDeviceManager : public QWaylandClientExtensionTemplate<DataControlDeviceManager>
         , public QtWayland::zwlr_data_control_manager_v1
 {
@@ -60,16 +121,30 @@ public:
     }
 
     ~DataControlOffer() {
+        for (QSocketNotifier *notifier : qAsConst(m_transfers)) {
+            close(notifier->socket());
+        }
         destroy();
     }
 
+    /**
+     * Starts reading the data of @p mimeTypes without blocking. ready() is
+     * emitted once all of them have been received or given up on, after
+     * which retrieveData() returns them without touching the source again.
+     */
+    void prefetch(const QStringList &mimeTypes);
+
     QStringList formats() const override
     {
         return m_receivedFormats;
     }
 
     bool hasFormat(const QString &format) const override {
-         return m_receivedFormats.contains(format);
+        if (format == s_qtImageFormat && !m_receivedFormats.contains(format)) {
+            // Decoded from the image type the source offers, see retrieveData()
+            return !imageFormat(m_receivedFormats).isEmpty();
+        }
+        return m_receivedFormats.contains(format);
     }
 protected:
     void zwlr_data_control_offer_v1_offer(const QString &mime_type) override {
@@ -77,11 +152,116 @@ protected:
     }
 
     QVariant retrieveData(const QString &mimeType, QVariant::Type type) const override;
+
+Q_SIGNALS:
+    void ready();
+
 private:
     static bool readData(int fd, QByteArray &data);
+    void readAvailable(const QString &mimeType);
+    void finishTransfer(const QString &mimeType, bool success);
     QStringList m_receivedFormats;
+    QHash<QString, QByteArray> m_data; // received, or still being received
+    QHash<QString, QSocketNotifier *> m_transfers; // in progress
+    QSet<QString> m_failedFormats;
 };
 
+void DataControlOffer::prefetch(const QStringList &mimeTypes)
+{
+    for (const QString &mimeType : mimeTypes) {
+        if (!hasFormat(mimeType) || m_data.contains(mimeType) || m_transfers.contains(mimeType)) {
+            continue;
+        }
+
+        int pipeFds[2];
+        if (pipe(pipeFds) != 0) {
+            continue;
+        }
+        fcntl(pipeFds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(pipeFds[0], F_SETFL, O_NONBLOCK);
+
+        receive(mimeType, pipeFds[1]);
+        close(pipeFds[1]);
+
+        auto notifier = new QSocketNotifier(pipeFds[0], QSocketNotifier::Read, this);
+        connect(notifier, &QSocketNotifier::activated, this, [this, mimeType]() {
+            readAvailable(mimeType);
+        });
+        m_data.insert(mimeType, QByteArray());
+        m_transfers.insert(mimeType, notifier);
+    }
+
+    if (m_transfers.isEmpty()) {
+        Q_EMIT ready();
+        return;
+    }
+
+    QPlatformNativeInterface *native = qApp->platformNativeInterface();
+    auto display = static_cast<struct ::wl_display*>(native->nativeResourceForIntegration("wl_display"));
+    wl_display_flush(display);
+
+    QTimer::singleShot(TRANSFER_TIMEOUT, this, [this]() {
+        const QStringList pending = m_transfers.keys();
+        for (const QString &mimeType : pending) {
+            qWarning() << "DataControlOffer: timeout reading" << mimeType;
+            finishTransfer(mimeType, false);
+        }
+    });
+}
+
+void DataControlOffer::readAvailable(const QString &mimeType)
+{
+    QSocketNotifier *notifier = m_transfers.value(mimeType);
+    if (!notifier) {
+        return;
+    }
+    QByteArray &data = m_data[mimeType];
+
+    Q_FOREVER {
+        char buf[4096];
+        const ssize_t n = read(notifier->socket(), buf, sizeof buf);
+
+        if (n > 0) {
+            if (data.size() + n > MAX_TRANSFER_SIZE) {
+                qWarning() << "DataControlOffer: ignoring" << mimeType << "larger than" << MAX_TRANSFER_SIZE << "bytes";
+                finishTransfer(mimeType, false);
+                return;
+            }
+            data.append(buf, n);
+        } else if (n == 0) {
+            finishTransfer(mimeType, true);
+            return;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // wait for the source to write more
+            return;
+        } else if (errno != EINTR) {
+            qWarning() << "DataControlOffer: read() failed for" << mimeType;
+            finishTransfer(mimeType, false);
+            return;
+        }
+    }
+}
+
+void DataControlOffer::finishTransfer(const QString &mimeType, bool success)
+{
+    QSocketNotifier *notifier = m_transfers.take(mimeType);
+    if (!notifier) {
+        return;
+    }
+    notifier->setEnabled(false);
+    close(notifier->socket());
+    notifier->deleteLater();
+
+    if (!success) {
+        m_data.remove(mimeType);
+        m_failedFormats.insert(mimeType);
+    }
+
+    if (m_transfers.isEmpty()) {
+        Q_EMIT ready();
+    }
+}
+
 
 QVariant DataControlOffer::retrieveData(const QString &mimeType, QVariant::Type type) const
 {
@@ -90,6 +270,21 @@ QVariant DataControlOffer::retrieveData(const QString &mimeType, QVariant::Type
     }
     Q_UNUSED(type);
 
+    if (mimeType == s_qtImageFormat && !m_receivedFormats.contains(mimeType)) {
+        const QString format = imageFormat(m_receivedFormats);
+        const QImage image = QImage::fromData(retrieveData(format, QVariant::ByteArray).toByteArray());
+        return image.isNull() ? QVariant() : QVariant(image);
+    }
+
+    if (m_data.contains(mimeType) || m_failedFormats.contains(mimeType)) {
+        // Don't read again what's being or has been prefetched. While a
+        // transfer is still in progress there's nothing to return yet.
+        if (m_transfers.contains(mimeType)) {
+            return QVariant();
+        }
+        return m_data.value(mimeType);
+    }
+
     int pipeFds[2];
     if (pipe(pipeFds) != 0){
         return QVariant();
@@ -111,13 +306,11 @@ QVariant DataControlOffer::retrieveData(const QString &mimeType, QVariant::Type
     auto display = static_cast<struct ::wl_display*>(native->nativeResourceForIntegration("wl_display"));
     wl_display_flush(display);
 
-    QFile readPipe;
-    if (readPipe.open(pipeFds[0], QIODevice::ReadOnly)) {
-        QByteArray data;
-        if (readData(pipeFds[0], data)) {
-            return data;
-        }
-        close(pipeFds[0]);
+    QByteArray data;
+    const bool success = readData(pipeFds[0], data);
+    close(pipeFds[0]);
+    if (success) {
+        return data;
     }
     return QVariant();
 }
@@ -151,6 +344,10 @@ bool DataControlOffer::readData(int fd, QByteArray &data)
             } else if (n == 0) {
                 return true;
             } else if (n > 0) {
+                if (data.size() + n > MAX_TRANSFER_SIZE) {
+                    qWarning("DataControlOffer: data too large");
+                    return false;
+                }
                 data.append(buf, n);
             }
         }
@@ -165,6 +362,9 @@ public:
     DataControlSource(struct ::zwlr_data_control_source_v1 *id, QMimeData *mimeData);
     DataControlSource();
     ~DataControlSource() {
+        for (QSocketNotifier *notifier : qAsConst(m_transfers)) {
+            close(notifier->socket());
+        }
         destroy();
     }
 
@@ -179,7 +379,9 @@ protected:
     void zwlr_data_control_source_v1_send(const QString &mime_type, int32_t fd) override;
     void zwlr_data_control_source_v1_cancelled() override;
 private:
+    void writeAvailable(QSocketNotifier *notifier, const QByteArray &data, int &written);
     QMimeData *m_mimeData;
+    QVector<QSocketNotifier *> m_transfers; // in progress
 };
 
 DataControlSource::DataControlSource(struct ::zwlr_data_control_source_v1 *id, QMimeData *mimeData)
@@ -193,11 +395,40 @@ DataControlSource::DataControlSource(struct ::zwlr_data_control_source_v1 *id, Q
 
 void DataControlSource::zwlr_data_control_source_v1_send(const QString &mime_type, int32_t fd)
 {
-    QFile c;
-    if (c.open(fd, QFile::WriteOnly, QFile::AutoCloseHandle)) {
-        c.write(m_mimeData->data(mime_type));
-        c.close();
+    // Write without blocking, the reader may well be this very process
+    // waiting for the event loop, e.g. when reading its own selection.
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    const QByteArray data = m_mimeData->data(mime_type);
+    auto notifier = new QSocketNotifier(fd, QSocketNotifier::Write, this);
+    m_transfers.append(notifier);
+    connect(notifier, &QSocketNotifier::activated, this, [this, notifier, data, written = 0]() mutable {
+        writeAvailable(notifier, data, written);
+    });
+}
+
+void DataControlSource::writeAvailable(QSocketNotifier *notifier, const QByteArray &data, int &written)
+{
+    while (written < data.size()) {
+        const ssize_t n = write(notifier->socket(), data.constData() + written, data.size() - written);
+
+        if (n > 0) {
+            written += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // wait for the reader to catch up
+            return;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            qWarning() << "DataControlSource: write() failed";
+            break;
+        }
     }
+
+    notifier->setEnabled(false);
+    close(notifier->socket());
+    m_transfers.removeOne(notifier);
+    notifier->deleteLater();
 }
 
 void DataControlSource::zwlr_data_control_source_v1_cancelled()
@@ -237,26 +468,58 @@ protected:
 
     void zwlr_data_control_device_v1_selection(struct ::zwlr_data_control_offer_v1 *id) override {
         if(!id ) {
+            m_pendingSelection.reset();
             m_receivedSelection.reset();
+            emit receivedSelectionChanged();
         } else {
             auto deriv = QtWayland::zwlr_data_control_offer_v1::fromObject(id);
             auto offer = dynamic_cast<DataControlOffer*>(deriv); // dynamic because of the dual inheritance
-            m_receivedSelection.reset(offer);
+            if (m_selection) {
+                // Most likely the echo of our own selection, which is served
+                // from m_selection, so don't read it back unless that's cancelled
+                m_pendingSelection.reset();
+                m_receivedSelection.reset(offer);
+                m_receivedSelectionFetched = false;
+                emit receivedSelectionChanged();
+            } else {
+                fetchSelection(offer);
+            }
         }
-        emit receivedSelectionChanged();
     }
 
 private:
+    void fetchSelection(DataControlOffer *offer);
+
     std::unique_ptr<DataControlSource> m_selection; // selection set locally
     std::unique_ptr<DataControlOffer> m_receivedSelection; // latest selection set from externally to here
+    bool m_receivedSelectionFetched = false;
+    std::unique_ptr<DataControlOffer> m_pendingSelection; // newer selection whose data is still being read
 };
 
+void DataControlDevice::fetchSelection(DataControlOffer *offer)
+{
+    // Only announce the new selection once the data it will be asked
+    // for has arrived, so that reading it doesn't block.
+    m_pendingSelection.reset(offer);
+    connect(offer, &DataControlOffer::ready, this, [this]() {
+        m_receivedSelection = std::move(m_pendingSelection);
+        m_receivedSelectionFetched = true;
+        emit receivedSelectionChanged();
+    });
+    offer->prefetch(prefetchedFormats(offer->formats()));
+}
+
 
 void DataControlDevice::setSelection(std::unique_ptr<DataControlSource> selection)
 {
     m_selection = std::move(selection);
     connect(m_selection.get(), &DataControlSource::cancelled, this, [this]() {
         m_selection.reset();
+        // The selection that replaced ours arrived while it was still set
+        if (m_receivedSelection && !m_receivedSelectionFetched) {
+            fetchSelection(m_receivedSelection.release());
+            return;
+        }
         Q_EMIT selectionChanged();
     });
     set_selection(m_selection->object());
@@ -44,6 +44,10 @@
 #include "history.h"
 #include "historystringitem.h"
 
+// Clipboard contents longer than this are not matched against the actions
+// on every change, only when the user explicitly asks for actions.
+static const int MAX_AUTOMATIC_MATCH_LENGTH = 256 * 1024;
+
 URLGrabber::URLGrabber(History* history):
     m_myCurrentAction(nullptr),
     m_myMenu(nullptr),
@@ -138,14 +142,19 @@ const ActionList& URLGrabber::matchingActions( const QString& clipData, bool aut
 {
     m_myMatches.clear();
 
+    if (automatically_invoked && clipData.length() > MAX_AUTOMATIC_MATCH_LENGTH) {
+        return m_myMatches;
+    }
+
     matchingMimeActions(clipData);
 
     // now look for matches in custom user actions
-    QRegularExpression re;
     foreach (ClipAction* action, m_myActions) {
-        re.setPattern(action->actionRegexPattern());
-        const QRegularExpressionMatch match = re.match(clipData);
-        if (match.hasMatch() && (action->automatic() || !automatically_invoked)) {
+        if (automatically_invoked && !action->automatic()) {
+            continue;
+        }
+        const QRegularExpressionMatch match = action->match(clipData);
+        if (match.hasMatch()) {
             action->setActionCapturedTexts(match.capturedTexts());
             m_myMatches.append( action );
         }
@@ -385,15 +394,17 @@ ClipCommand::ClipCommand(const QString&_command, const QString& _description,
 
 
 ClipAction::ClipAction( const QString& regExp, const QString& description, bool automatic )
-    : m_regexPattern( regExp ), m_myDescription( description ), m_automatic(automatic)
+    : m_regex( regExp ), m_myDescription( description ), m_automatic(automatic)
 {
+    m_regex.optimize();
 }
 
 ClipAction::ClipAction( KSharedConfigPtr kc, const QString& group )
-    : m_regexPattern( kc->group(group).readEntry("Regexp") ),
+    : m_regex( kc->group(group).readEntry("Regexp") ),
       m_myDescription (kc->group(group).readEntry("Description") ),
       m_automatic(kc->group(group).readEntry("Automatic", QVariant(true)).toBool() )
 {
+    m_regex.optimize();
     KConfigGroup cg(kc, group);
 
     int num = cg.readEntry( "Number of commands", 0 );
@@ -418,6 +429,17 @@ ClipAction::~ClipAction()
 }
 
 
+void ClipAction::setActionRegexPattern(const QString &pattern)
+{
+    if (pattern == m_regex.pattern()) {
+        return;
+    }
+    m_regex.setPattern(pattern);
+    // compile (and JIT) right away rather than on the next clipboard change
+    m_regex.optimize();
+}
+
+
 void ClipAction::addCommand( const ClipCommand& cmd )
 {
     if ( cmd.command.isEmpty() && cmd.serviceStorageId.isEmpty() )
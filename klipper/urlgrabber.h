@@ -20,6 +20,7 @@
 #define URLGRABBER_H
 
 #include <QHash>
+#include <QRegularExpression>
 #include <QStringList>
 #include <QSharedPointer>
 
@@ -144,8 +145,14 @@ public:
   ClipAction( KSharedConfigPtr kc, const QString& );
   ~ClipAction();
 
-  QString actionRegexPattern() const { return m_regexPattern; }
-  void  setActionRegexPattern(const QString &pattern) { m_regexPattern = pattern; }
+  QString actionRegexPattern() const { return m_regex.pattern(); }
+  void  setActionRegexPattern(const QString &pattern);
+
+  /**
+   * Matches @p text against the action's regular expression, which is
+   * compiled once and reused until the pattern changes.
+   */
+  QRegularExpressionMatch match(const QString &text) const { return m_regex.match(text); }
 
   QStringList actionCapturedTexts() const { return m_regexCapturedTexts; }
   void setActionCapturedTexts(const QStringList &captured) { m_regexCapturedTexts = captured; }
@@ -182,7 +189,7 @@ public:
 
 
 private:
-  QString m_regexPattern;
+  QRegularExpression m_regex;
   QStringList m_regexCapturedTexts;
   QString m_myDescription;
   QList<ClipCommand> m_myCommands;
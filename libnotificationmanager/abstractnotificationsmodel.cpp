@@ -28,7 +28,9 @@
 #include "notification_p.h"
 
 #include <QDebug>
+#include <QFutureWatcher>
 #include <QProcess>
+#include <QtConcurrent>
 
 #include <KShell>
 
@@ -43,13 +45,19 @@ AbstractNotificationsModel::Private::Private(AbstractNotificationsModel *q)
     : q(q)
     , lastRead(QDateTime::currentDateTimeUtc())
 {
+    imageDecodingPool.setMaxThreadCount(2);
+
+    connect(&notificationTimeouts, &TimerWheel::timeout, q, [q](uint id) {
+        q->expire(id);
+    });
+
     pendingRemovalTimer.setSingleShot(true);
     pendingRemovalTimer.setInterval(50);
     connect(&pendingRemovalTimer, &QTimer::timeout, q, [this, q] {
         QVector<int> rowsToBeRemoved;
         rowsToBeRemoved.reserve(pendingRemovals.count());
         for (uint id : qAsConst(pendingRemovals)) {
-            int row = q->rowOfNotification(id); // oh the complexity...
+            const int row = q->rowOfNotification(id);
             if (row == -1) {
                 continue;
             }
@@ -60,11 +68,7 @@ AbstractNotificationsModel::Private::Private(AbstractNotificationsModel *q)
     });
 }
 
-AbstractNotificationsModel::Private::~Private()
-{
-    qDeleteAll(notificationTimeouts);
-    notificationTimeouts.clear();
-}
+AbstractNotificationsModel::Private::~Private() = default;
 
 void AbstractNotificationsModel::Private::onNotificationAdded(const Notification &notification)
 {
@@ -75,17 +79,22 @@ void AbstractNotificationsModel::Private::onNotificationAdded(const Notification
         qCDebug(NOTIFICATIONMANAGER) << "Reached the notification limit of" << s_notificationsLimit << ", discarding the oldest" << cleanupCount << "notifications";
         q->beginRemoveRows(QModelIndex(), 0, cleanupCount - 1);
         for (int i = 0 ; i < cleanupCount; ++i) {
-            notifications.removeAt(0);
+            rowOfId.remove(notifications.at(i).id());
             // TODO close gracefully?
         }
+        notifications.remove(0, cleanupCount);
+        updateRowIndex(0);
         q->endRemoveRows();
     }
 
     setupNotificationTimeout(notification);
 
     q->beginInsertRows(QModelIndex(), notifications.count(), notifications.count());
+    rowOfId.insert(notification.id(), notifications.count());
     notifications.append(std::move(notification));
     q->endInsertRows();
+
+    decodeImage(notification);
 }
 
 void AbstractNotificationsModel::Private::onNotificationReplaced(uint replacedId, const Notification &notification)
@@ -100,9 +109,15 @@ void AbstractNotificationsModel::Private::onNotificationReplaced(uint replacedId
 
     setupNotificationTimeout(notification);
 
+    if (notification.id() != replacedId) {
+        rowOfId.remove(replacedId);
+        rowOfId.insert(notification.id(), row);
+    }
     notifications[row] = notification;
     const QModelIndex idx = q->index(row, 0);
     emit q->dataChanged(idx, idx);
+
+    decodeImage(notification);
 }
 
 void AbstractNotificationsModel::Private::onNotificationRemoved(uint removedId, Server::CloseReason reason)
@@ -159,22 +174,48 @@ void AbstractNotificationsModel::Private::setupNotificationTimeout(const Notific
         return;
     }
 
-    QTimer *timer = notificationTimeouts.value(notification.id());
-    if (!timer) {
-        timer = new QTimer();
-        timer->setSingleShot(true);
+    notificationTimeouts.schedule(notification.id(),
+        60000 /*1min*/ + (notification.timeout() == -1 ? 120000 /*2min, max configurable default timeout*/ : notification.timeout()));
+}
 
-        connect(timer, &QTimer::timeout, q, [this, timer] {
-            const uint id = timer->property("notificationId").toUInt();
-            q->expire(id);
-        });
-        notificationTimeouts.insert(notification.id(), timer);
+void AbstractNotificationsModel::Private::decodeImage(const Notification &notification)
+{
+    const QSharedPointer<const NotificationImageSource> source = notification.d->pendingImage;
+    if (!source) {
+        return;
     }
 
-    timer->stop();
-    timer->setProperty("notificationId", notification.id());
-    timer->setInterval(60000 /*1min*/ + (notification.timeout() == -1 ? 120000 /*2min, max configurable default timeout*/ : notification.timeout()));
-    timer->start();
+    const uint id = notification.id();
+
+    auto *watcher = new QFutureWatcher<QImage>(q);
+    connect(watcher, &QFutureWatcher<QImage>::finished, q, [this, watcher, id, source] {
+        watcher->deleteLater();
+
+        const int row = q->rowOfNotification(id);
+        if (row == -1) {
+            return;
+        }
+
+        // It might have been replaced or decoded synchronously in the meantime
+        Notification &notification = notifications[row];
+        if (notification.d->pendingImage != source) {
+            return;
+        }
+
+        notification.d->image = watcher->result();
+        notification.d->pendingImage.reset();
+        if (!notification.d->image.isNull()) {
+            notification.d->icon.clear();
+        }
+
+        const QModelIndex idx = q->index(row, 0);
+        emit q->dataChanged(idx, idx, {Notifications::ImageRole, Notifications::IconNameRole});
+    });
+
+    const QSize maximumSize = Notification::Private::maximumImageSize();
+    watcher->setFuture(QtConcurrent::run(&imageDecodingPool, [source, maximumSize] {
+        return source->decode(maximumSize);
+    }));
 }
 
 void AbstractNotificationsModel::Private::removeRows(const QVector<int> &rows)
@@ -209,29 +250,42 @@ void AbstractNotificationsModel::Private::removeRows(const QVector<int> &rows)
         const auto &range = clearQueue.at(i);
 
         q->beginRemoveRows(QModelIndex(), range.first, range.second);
-        for (int j = range.second; j >= range.first; --j) {
-            notifications.removeAt(j);
-            ++rowsRemoved;
+        for (int j = range.first; j <= range.second; ++j) {
+            rowOfId.remove(notifications.at(j).id());
         }
+        notifications.remove(range.first, range.second - range.first + 1);
+        rowsRemoved += range.second - range.first + 1;
         q->endRemoveRows();
     }
 
     Q_ASSERT(rowsRemoved == rowsToBeRemoved.count());
 
+    // Renumber everything after the first removed row once rather than after every range
+    updateRowIndex(clearQueue.first().first);
+
     pendingRemovals.clear();
 }
 
-int AbstractNotificationsModel::rowOfNotification(uint id) const
+void AbstractNotificationsModel::Private::updateRowIndex(int firstRow)
 {
-    auto it = std::find_if(d->notifications.constBegin(), d->notifications.constEnd(), [id](const Notification &item) {
-        return item.id() == id;
-    });
+    for (int i = firstRow; i < notifications.count(); ++i) {
+        rowOfId[notifications.at(i).id()] = i;
+    }
+}
 
-    if (it == d->notifications.constEnd()) {
-        return -1;
+int AbstractNotificationsModel::rowOfNotification(uint id) const
+{
+    const int row = d->rowOfId.value(id, -1);
+    if (row == -1 || (row < d->notifications.count() && d->notifications.at(row).id() == id)) {
+        return row;
     }
 
-    return std::distance(d->notifications.constBegin(), it);
+    // The index is only renumbered once all rows are removed,
+    // it can be stale while removal signals are being emitted
+    auto it = std::find_if(d->notifications.constBegin(), d->notifications.constEnd(), [id](const Notification &notification) {
+        return notification.id() == id;
+    });
+    return it != d->notifications.constEnd() ? int(std::distance(d->notifications.constBegin(), it)) : -1;
 }
 
 AbstractNotificationsModel::AbstractNotificationsModel()
@@ -279,14 +333,16 @@ QVariant AbstractNotificationsModel::data(const QModelIndex &index, int role) co
         break;
     case Notifications::SummaryRole: return notification.summary();
     case Notifications::BodyRole: return notification.body();
+    // Don't use image() here, which would decode an image still pending
+    // on the main thread, we'll emit dataChanged once it's done
     case Notifications::IconNameRole:
-        if (notification.image().isNull()) {
+        if (notification.d->image.isNull() && !notification.d->pendingImage) {
             return notification.icon();
         }
         break;
     case Notifications::ImageRole:
-        if (!notification.image().isNull()) {
-            return notification.image();
+        if (!notification.d->image.isNull()) {
+            return notification.d->image;
         }
         break;
     case Notifications::DesktopEntryRole: return notification.desktopEntry();
@@ -379,7 +435,7 @@ void AbstractNotificationsModel::startTimeout(uint notificationId)
 
 void AbstractNotificationsModel::stopTimeout(uint notificationId)
 {
-    delete d->notificationTimeouts.take(notificationId);
+    d->notificationTimeouts.cancel(notificationId);
 }
 
 void AbstractNotificationsModel::clear(Notifications::ClearFlags flags)
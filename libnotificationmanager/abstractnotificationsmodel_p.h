@@ -23,8 +23,10 @@
 
 #include "notification.h"
 #include "server.h"
+#include "timerwheel_p.h"
 
 #include <QDateTime>
+#include <QThreadPool>
 #include <QTimer>
 
 class QTimer;
@@ -43,22 +45,32 @@ public:
     void onNotificationRemoved(uint notificationId, Server::CloseReason reason);
 
     void setupNotificationTimeout(const Notification &notification);
+    // Decodes the image of the notification in the background, if it has one
+    void decodeImage(const Notification &notification);
 
     void removeRows(const QVector<int> &rows);
+    // Updates rowOfId for the rows starting at the given one after they moved
+    void updateRowIndex(int firstRow);
 
     AbstractNotificationsModel *q;
 
     QVector<Notification> notifications;
+    QHash<uint /*notificationId*/, int /*row*/> rowOfId;
     // Fallback timeout to ensure all notifications expire eventually
     // otherwise when it isn't shown to the user and doesn't expire
     // an app might wait indefinitely for the notification to do so
-    QHash<uint /*notificationId*/, QTimer*> notificationTimeouts;
+    // These are all one minute or more, a single timer with a
+    // resolution of a second is good enough
+    TimerWheel notificationTimeouts;
 
     QVector<uint /*notificationId*/> pendingRemovals;
     QTimer pendingRemovalTimer;
 
     QDateTime lastRead;
 
+    // Image decoding of applications flooding us shouldn't occupy the global pool
+    QThreadPool imageDecodingPool;
+
 };
 
 }
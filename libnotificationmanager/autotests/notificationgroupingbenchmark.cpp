@@ -0,0 +1,146 @@
+/*
+ * This program is free software you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+*/
+
+#include <QtTest>
+#include <QObject>
+#include <QStandardItemModel>
+
+#include "notificationgroupingproxymodel_p.h"
+#include "notifications.h"
+
+namespace NotificationManager {
+
+class NotificationGroupingBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void grouping();
+    void benchmarkInsertRemove();
+
+private:
+    static void insertNotification(QStandardItemModel &source, int row, int app);
+    static void verifyMapping(const NotificationGroupingProxyModel &m, const QStandardItemModel &source);
+};
+
+void NotificationGroupingBenchmark::insertNotification(QStandardItemModel &source, int row, int app)
+{
+    auto *item = new QStandardItem;
+    item->setData(QStringLiteral("App %1").arg(app), Notifications::ApplicationNameRole);
+    item->setData(QStringLiteral("org.example.app%1").arg(app), Notifications::DesktopEntryRole);
+    source.insertRow(row, item);
+}
+
+void NotificationGroupingBenchmark::verifyMapping(const NotificationGroupingProxyModel &m, const QStandardItemModel &source)
+{
+    for (int i = 0; i < source.rowCount(); ++i) {
+        const QModelIndex sourceIndex = source.index(i, 0);
+        const QModelIndex proxyIndex = m.mapFromSource(sourceIndex);
+
+        QVERIFY(proxyIndex.isValid());
+        QCOMPARE(m.mapToSource(proxyIndex), sourceIndex);
+        QCOMPARE(proxyIndex.data(Notifications::ApplicationNameRole), sourceIndex.data(Notifications::ApplicationNameRole));
+
+        if (proxyIndex.parent().isValid()) {
+            QCOMPARE(m.index(proxyIndex.row(), 0, proxyIndex.parent()), proxyIndex);
+        }
+    }
+}
+
+void NotificationGroupingBenchmark::grouping()
+{
+    QStandardItemModel source;
+    NotificationGroupingProxyModel m;
+    m.setSourceModel(&source);
+
+    insertNotification(source, 0, 1);
+    insertNotification(source, 1, 2);
+    insertNotification(source, 2, 1);
+    insertNotification(source, 0, 2);
+
+    // Notifications without an application name are never grouped
+    source.appendRow(new QStandardItem);
+    source.appendRow(new QStandardItem);
+
+    QCOMPARE(m.rowCount(), 4);
+    QCOMPARE(m.rowCount(m.index(0, 0)), 2);
+    QCOMPARE(m.rowCount(m.index(1, 0)), 2);
+    QVERIFY(m.index(0, 0).data(Notifications::IsGroupRole).toBool());
+    QCOMPARE(m.index(0, 0).data(Notifications::GroupChildrenCountRole).toInt(), 2);
+    QVERIFY(!m.index(2, 0).data(Notifications::IsGroupRole).toBool());
+    verifyMapping(m, source);
+
+    // Dissolve a group
+    source.removeRow(1);
+    QCOMPARE(m.rowCount(), 4);
+    QCOMPARE(m.rowCount(m.index(0, 0)), 0);
+    QCOMPARE(m.rowCount(m.index(1, 0)), 2);
+    verifyMapping(m, source);
+
+    // A later notification joins the remaining one
+    insertNotification(source, 0, 1);
+    QCOMPARE(m.rowCount(), 4);
+    QCOMPARE(m.rowCount(m.index(0, 0)), 2);
+    verifyMapping(m, source);
+
+    // A new top-level item once the last notification of an application is gone
+    source.removeRow(3);
+    source.removeRow(0);
+    QCOMPARE(m.rowCount(), 3);
+    insertNotification(source, source.rowCount(), 1);
+    QCOMPARE(m.rowCount(), 4);
+    QCOMPARE(m.rowCount(m.index(3, 0)), 0);
+    verifyMapping(m, source);
+
+    // Rebuilding the map yields the same grouping
+    NotificationGroupingProxyModel rebuilt;
+    rebuilt.setSourceModel(&source);
+    QCOMPARE(rebuilt.rowCount(), m.rowCount());
+    verifyMapping(rebuilt, source);
+}
+
+void NotificationGroupingBenchmark::benchmarkInsertRemove()
+{
+    const int notifications = 5000;
+    const int apps = 50;
+
+    QBENCHMARK {
+        QStandardItemModel source;
+        NotificationGroupingProxyModel m;
+        m.setSourceModel(&source);
+
+        for (int i = 0; i < notifications; ++i) {
+            insertNotification(source, i, i % apps);
+        }
+
+        QCOMPARE(m.rowCount(), apps);
+        QCOMPARE(m.rowCount(m.index(0, 0)), notifications / apps);
+
+        // Remove from the middle, so that both the rows before and after the
+        // removed one are affected.
+        while (source.rowCount()) {
+            source.removeRow(source.rowCount() / 2);
+        }
+
+        QCOMPARE(m.rowCount(), 0);
+    }
+}
+
+} // namespace NotificationManager
+
+QTEST_GUILESS_MAIN(NotificationManager::NotificationGroupingBenchmark)
+
+#include "notificationgroupingbenchmark.moc"
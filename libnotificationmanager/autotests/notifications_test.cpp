@@ -21,10 +21,17 @@
 #include <QtTest>
 #include <QObject>
 #include <QDebug>
+#include <QImage>
+#include <QTemporaryDir>
 
 #include "notification.h"
 #include "notificationsmodel.h"
+#include "ratelimiter_p.h"
+#include "replacementqueue_p.h"
 #include "server.h"
+#include "timerwheel_p.h"
+
+#include <algorithm>
 
 namespace NotificationManager {
 
@@ -38,6 +45,11 @@ private Q_SLOTS:
     void parse();
 
     void compressNotificationRemoval();
+    void rowOfNotification();
+    void decodeImageInBackground();
+    void timerWheel();
+    void rateLimiter();
+    void coalesceReplacements();
 };
 
 void NotificationTest::parse_data()
@@ -148,6 +160,184 @@ void NotificationTest::compressNotificationRemoval()
     QCOMPARE(model->rowCount(), 0);
 }
 
+void NotificationTest::rowOfNotification()
+{
+    auto model = NotificationsModel::createNotificationsModel();
+
+    auto verifyRows = [&model] {
+        for (int row = 0; row < model->rowCount(); ++row) {
+            const uint id = model->index(row, 0).data(Notifications::IdRole).toUInt();
+            QCOMPARE(model->rowOfNotification(id), row);
+        }
+    };
+
+    for (uint i = 1; i <= 20; ++i) {
+        model->onNotificationAdded(Notification{i});
+    }
+    verifyRows();
+
+    // Remove several ranges at once
+    QSignalSpy rowsRemovedSpy(model.data(), &QAbstractItemModel::rowsRemoved);
+    for (uint id : {2, 3, 7, 8, 9, 15, 20}) {
+        model->onNotificationRemoved(id, Server::CloseReason::Revoked);
+    }
+    QTRY_COMPARE(rowsRemovedSpy.count(), 4);
+
+    QCOMPARE(model->rowCount(), 13);
+    verifyRows();
+    for (uint id : {2, 3, 7, 8, 9, 15, 20}) {
+        QCOMPARE(model->rowOfNotification(id), -1);
+    }
+
+    // Replacing keeps the row
+    Notification replacement{10};
+    replacement.setSummary(QStringLiteral("Replaced"));
+    model->onNotificationReplaced(10, replacement);
+    QCOMPARE(model->rowOfNotification(10), 4);
+    QCOMPARE(model->index(4, 0).data(Notifications::SummaryRole).toString(), QStringLiteral("Replaced"));
+    verifyRows();
+
+    model->onNotificationAdded(Notification{21});
+    QCOMPARE(model->rowOfNotification(21), model->rowCount() - 1);
+    verifyRows();
+}
+
+void NotificationTest::decodeImageInBackground()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("image.png"));
+    QImage image(1024, 512, QImage::Format_ARGB32);
+    image.fill(Qt::red);
+    QVERIFY(image.save(path));
+
+    auto model = NotificationsModel::createNotificationsModel();
+    QSignalSpy dataChangedSpy(model.data(), &QAbstractItemModel::dataChanged);
+
+    Notification notification{1};
+    notification.setIcon(path);
+    model->onNotificationAdded(notification);
+
+    // The image arrives later and is scaled down
+    const QModelIndex idx = model->index(0, 0);
+    QTRY_VERIFY(!idx.data(Notifications::ImageRole).isNull());
+    QCOMPARE(dataChangedSpy.count(), 1);
+    QVERIFY(dataChangedSpy.first().at(2).value<QVector<int>>().contains(Notifications::ImageRole));
+    QCOMPARE(idx.data(Notifications::ImageRole).value<QImage>().size(), QSize(256, 128));
+
+    // Without a model the image is decoded when asked for
+    Notification standalone{2};
+    standalone.setIcon(path);
+    QCOMPARE(standalone.image().size(), QSize(256, 128));
+}
+
+void NotificationTest::timerWheel()
+{
+    // 10ms ticks on a wheel of four slots, i.e. 40ms per turn
+    TimerWheel wheel(10, 4);
+    QSignalSpy timeoutSpy(&wheel, &TimerWheel::timeout);
+
+    wheel.schedule(1, 25);
+    wheel.schedule(2, 100); // takes multiple turns
+    wheel.schedule(3, 30);
+    wheel.cancel(3);
+    wheel.schedule(4, 5);
+    wheel.schedule(4, 60); // rescheduled
+    QCOMPARE(wheel.count(), 3);
+
+    QTRY_COMPARE(timeoutSpy.count(), 3);
+    QCOMPARE(timeoutSpy.at(0).at(0).toUInt(), 1u);
+    QCOMPARE(timeoutSpy.at(1).at(0).toUInt(), 4u);
+    QCOMPARE(timeoutSpy.at(2).at(0).toUInt(), 2u);
+    QCOMPARE(wheel.count(), 0);
+    QVERIFY(!wheel.isScheduled(3));
+}
+
+void NotificationTest::rateLimiter()
+{
+    // Three at once, then one every 100ms
+    RateLimiter limiter(3, 10);
+    const QString sender = QStringLiteral(":1.42");
+    const QString other = QStringLiteral(":1.43");
+
+    QVERIFY(limiter.consume(sender, 0));
+    QVERIFY(limiter.consume(sender, 0));
+    QVERIFY(limiter.consume(sender, 10));
+    QVERIFY(!limiter.consume(sender, 20));
+
+    // Other senders have their own bucket
+    QVERIFY(limiter.consume(other, 20));
+
+    QVERIFY(!limiter.consume(sender, 90));
+    QVERIFY(limiter.consume(sender, 120));
+    QVERIFY(!limiter.consume(sender, 130));
+
+    // The bucket doesn't fill beyond the burst
+    QVERIFY(limiter.consume(sender, 10000));
+    QVERIFY(limiter.consume(sender, 10000));
+    QVERIFY(limiter.consume(sender, 10000));
+    QVERIFY(!limiter.consume(sender, 10000));
+
+    // Without a sender or with a burst of 0 nothing is limited
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(limiter.consume(QString(), 10000));
+    }
+    limiter.setLimit(0, 10);
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(limiter.consume(sender, 10000));
+    }
+
+    // Senders with a full bucket are forgotten once there are many
+    limiter.setLimit(3, 10);
+    for (int i = 0; i < 100; ++i) {
+        QVERIFY(limiter.consume(QString::number(i), 0));
+    }
+    QVERIFY(limiter.consume(sender, 1000));
+    QCOMPARE(limiter.count(), 1);
+}
+
+void NotificationTest::coalesceReplacements()
+{
+    ReplacementQueue queue(10);
+
+    QVector<Notification> replaced;
+    connect(&queue, &ReplacementQueue::replaced, this, [&replaced](const Notification &notification) {
+        replaced.append(notification);
+    });
+
+    for (int i = 0; i < 5; ++i) {
+        Notification progress{1};
+        progress.setSummary(QStringLiteral("Progress %1").arg(i));
+        queue.queue(progress, {}, {});
+    }
+
+    Notification other{2};
+    other.setSummary(QStringLiteral("Other"));
+    queue.queue(other, {}, {});
+
+    Notification closed{3};
+    queue.queue(closed, {}, {});
+    QVERIFY(queue.isQueued(3));
+    queue.discard(3);
+    QVERIFY(!queue.isQueued(3));
+
+    // Nothing is emitted right away, then only the latest state of each
+    QVERIFY(replaced.isEmpty());
+    QTRY_COMPARE(replaced.count(), 2);
+    std::sort(replaced.begin(), replaced.end(), [](const Notification &a, const Notification &b) {
+        return a.id() < b.id();
+    });
+    QCOMPARE(replaced.at(0).id(), 1u);
+    QCOMPARE(replaced.at(0).summary(), QStringLiteral("Progress 4"));
+    QCOMPARE(replaced.at(1).id(), 2u);
+    QVERIFY(!queue.isQueued(1));
+
+    // Later replacements start a new interval
+    Notification again{1};
+    queue.queue(again, {}, {});
+    QTRY_COMPARE(replaced.count(), 3);
+}
+
 } // namespace NotificationManager
 
 QTEST_GUILESS_MAIN(NotificationManager::NotificationTest)
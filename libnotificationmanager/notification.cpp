@@ -22,16 +22,21 @@
 
 #include "notification.h"
 #include "notification_p.h"
+#include "utils_p.h"
 
 
 #include <QDBusArgument>
 #include <QDebug>
+#include <QHash>
 #include <QImageReader>
+#include <QPair>
 #include <QRegularExpression>
+#include <QStandardPaths>
 #include <QXmlStreamReader>
 
 #include <KConfig>
 #include <KConfigGroup>
+#include <KDirWatch>
 #include <KService>
 #include <KServiceTypeTrader>
 
@@ -39,6 +44,148 @@
 
 using namespace NotificationManager;
 
+namespace {
+
+// What the desktop entry and notifyrc name of a notification resolve to
+struct ApplicationInfo
+{
+    bool hasService = false;
+    QString desktopEntryName;
+    QString serviceName;
+    QString serviceIconName;
+    bool configurableService = false;
+
+    QString notifyRcIconName;
+    bool configurableNotifyRc = false;
+};
+
+// Caches ApplicationInfo per desktop entry and notifyrc name, so that
+// applications sending lots of notifications don't cause a sycoca query
+// and a notifyrc parse for each of them.
+// Entries are dropped when the sycoca database or the notifyrc changes.
+class Q_DECL_HIDDEN ApplicationInfoCache : public QObject
+{
+public:
+    ApplicationInfoCache();
+
+    ApplicationInfo info(const QString &desktopEntry, const QString &notifyRcName);
+
+private:
+    static ApplicationInfo resolve(const QString &desktopEntry, const QString &notifyRcName, QStringList *notifyRcFiles);
+    void watchNotifyRc(const QString &notifyRcName, const QStringList &fileNames);
+    void notifyRcChanged(const QString &fileName);
+
+    // Desktop entries are chosen by the sender, don't grow indefinitely
+    static const int s_maximumEntries = 256;
+
+    QHash<QPair<QString, QString>, ApplicationInfo> m_entries;
+
+    KDirWatch *m_notifyRcWatcher;
+    QHash<QString /*fileName*/, QString /*notifyRcName*/> m_watchedNotifyRcFiles;
+};
+
+Q_GLOBAL_STATIC(ApplicationInfoCache, s_applicationInfoCache)
+
+ApplicationInfoCache::ApplicationInfoCache()
+    : m_notifyRcWatcher(new KDirWatch(this))
+{
+    Utils::connectToApplicationsChanged(this, [this] {
+        m_entries.clear();
+    });
+
+    connect(m_notifyRcWatcher, &KDirWatch::dirty, this, &ApplicationInfoCache::notifyRcChanged);
+    connect(m_notifyRcWatcher, &KDirWatch::created, this, &ApplicationInfoCache::notifyRcChanged);
+    connect(m_notifyRcWatcher, &KDirWatch::deleted, this, &ApplicationInfoCache::notifyRcChanged);
+}
+
+ApplicationInfo ApplicationInfoCache::info(const QString &desktopEntry, const QString &notifyRcName)
+{
+    const QPair<QString, QString> key(desktopEntry, notifyRcName);
+
+    auto it = m_entries.constFind(key);
+    if (it != m_entries.constEnd()) {
+        return *it;
+    }
+
+    QStringList notifyRcFiles;
+    const ApplicationInfo info = resolve(desktopEntry, notifyRcName, &notifyRcFiles);
+
+    if (!notifyRcName.isEmpty()) {
+        watchNotifyRc(notifyRcName, notifyRcFiles);
+    }
+
+    if (m_entries.count() >= s_maximumEntries) {
+        m_entries.clear();
+    }
+    m_entries.insert(key, info);
+
+    return info;
+}
+
+ApplicationInfo ApplicationInfoCache::resolve(const QString &desktopEntry, const QString &notifyRcName, QStringList *notifyRcFiles)
+{
+    ApplicationInfo info;
+
+    KService::Ptr service = Notification::Private::serviceForDesktopEntry(desktopEntry);
+    if (service) {
+        info.hasService = true;
+        info.desktopEntryName = service->desktopEntryName();
+        info.serviceName = service->name();
+        info.serviceIconName = service->icon();
+        info.configurableService = !service->noDisplay();
+    }
+
+    if (!notifyRcName.isEmpty()) {
+        // Check whether the application actually has notifications we can configure
+        *notifyRcFiles = QStandardPaths::locateAll(QStandardPaths::GenericDataLocation,
+                                                   QStringLiteral("knotifications5/") + notifyRcName + QStringLiteral(".notifyrc"));
+
+        KConfig config(notifyRcName + QStringLiteral(".notifyrc"), KConfig::NoGlobals);
+        config.addConfigSources(*notifyRcFiles);
+
+        KConfigGroup globalGroup(&config, "Global");
+
+        info.notifyRcIconName = globalGroup.readEntry("IconName");
+
+        const QRegularExpression regexp(QStringLiteral("^Event/([^/]*)$"));
+        info.configurableNotifyRc = !config.groupList().filter(regexp).isEmpty();
+
+        // The user's own configuration, which may not exist yet
+        notifyRcFiles->append(QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation)
+                              + QLatin1Char('/') + notifyRcName + QStringLiteral(".notifyrc"));
+    }
+
+    return info;
+}
+
+void ApplicationInfoCache::watchNotifyRc(const QString &notifyRcName, const QStringList &fileNames)
+{
+    for (const QString &fileName : fileNames) {
+        if (!m_watchedNotifyRcFiles.contains(fileName)) {
+            m_watchedNotifyRcFiles.insert(fileName, notifyRcName);
+            m_notifyRcWatcher->addFile(fileName);
+        }
+    }
+}
+
+void ApplicationInfoCache::notifyRcChanged(const QString &fileName)
+{
+    const QString notifyRcName = m_watchedNotifyRcFiles.value(fileName);
+    if (notifyRcName.isEmpty()) {
+        return;
+    }
+
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (it.key().second == notifyRcName) {
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+}
+
 Notification::Private::Private()
 {
 
@@ -130,88 +277,95 @@ QString Notification::Private::sanitize(const QString &text)
     return result;
 }
 
-QImage Notification::Private::decodeNotificationSpecImageHint(const QDBusArgument &arg)
+QSharedPointer<const NotificationImageSource> Notification::Private::readNotificationSpecImageHint(const QDBusArgument &arg)
 {
     int width, height, rowStride, hasAlpha, bitsPerSample, channels;
     QByteArray pixels;
-    char* ptr;
-    char* end;
 
     arg.beginStructure();
     arg >> width >> height >> rowStride >> hasAlpha >> bitsPerSample >> channels >> pixels;
     arg.endStructure();
 
+    if (bitsPerSample != 8 || (channels != 3 && channels != 4)) {
+        qCWarning(NOTIFICATIONMANAGER) << "Unsupported image format (hasAlpha:" << hasAlpha << "bitsPerSample:" << bitsPerSample << "channels:" << channels << ")";
+        return QSharedPointer<const NotificationImageSource>();
+    }
+
     #define SANITY_CHECK(condition) \
     if (!(condition)) { \
         qCWarning(NOTIFICATIONMANAGER) << "Image decoding sanity check failed on" << #condition; \
-        return QImage(); \
+        return QSharedPointer<const NotificationImageSource>(); \
     }
 
     SANITY_CHECK(width > 0);
     SANITY_CHECK(width < 2048);
     SANITY_CHECK(height > 0);
     SANITY_CHECK(height < 2048);
-    SANITY_CHECK(rowStride > 0);
+    SANITY_CHECK(rowStride >= channels * width);
+    // Rows may be padded, but not beyond what the widest image could need
+    SANITY_CHECK(rowStride < 4 * 2048 + 64);
 
     #undef SANITY_CHECK
 
-    auto copyLineRGB32 = [](QRgb* dst, const char* src, int width)
-    {
-        const char* end = src + width * 3;
-        for (; src != end; ++dst, src+=3) {
-            *dst = qRgb(src[0], src[1], src[2]);
-        }
-    };
+    QSharedPointer<NotificationImageSource> source(new NotificationImageSource);
+    source->pixels = pixels;
+    source->width = width;
+    source->height = height;
+    source->rowStride = rowStride;
+    source->channels = channels;
+    return source;
+}
 
-    auto copyLineARGB32 = [](QRgb* dst, const char* src, int width)
-    {
-        const char* end = src + width * 4;
-        for (; src != end; ++dst, src+=4) {
-            *dst = qRgba(src[0], src[1], src[2], src[3]);
-        }
-    };
-
-    QImage::Format format = QImage::Format_Invalid;
-    void (*fcn)(QRgb*, const char*, int) = nullptr;
-    if (bitsPerSample == 8) {
-        if (channels == 4) {
-            format = QImage::Format_ARGB32;
-            fcn = copyLineARGB32;
-        } else if (channels == 3) {
-            format = QImage::Format_RGB32;
-            fcn = copyLineRGB32;
-        }
-    }
-    if (format == QImage::Format_Invalid) {
-        qCWarning(NOTIFICATIONMANAGER) << "Unsupported image format (hasAlpha:" << hasAlpha << "bitsPerSample:" << bitsPerSample << "channels:" << channels << ")";
-        return QImage();
-    }
+QImage NotificationImageSource::decodePixels() const
+{
+    // The dimensions were checked when reading the hint, this can't overflow
+    const qint64 lineSize = qint64(channels) * width;
+    const qint64 size = qint64(rowStride) * (height - 1) + lineSize;
 
-    QImage image(width, height, format);
-    ptr = pixels.data();
-    end = ptr + pixels.length();
-    for (int y=0; y<height; ++y, ptr += rowStride) {
-        if (ptr + channels * width > end) {
-            qCWarning(NOTIFICATIONMANAGER)  << "Image data is incomplete. y:" << y << "height:" << height;
-            break;
+    int rows = height;
+    if (pixels.size() < size) {
+        // only show the rows that are actually there
+        rows = pixels.size() < lineSize ? 0 : int((pixels.size() - lineSize) / rowStride) + 1;
+        qCWarning(NOTIFICATIONMANAGER) << "Image data is incomplete. rows:" << rows << "height:" << height;
+        if (rows == 0) {
+            return QImage();
         }
-        fcn((QRgb*)image.scanLine(y), ptr, width);
     }
 
-    return image;
+    // The hint is a byte array of R, G, B (and A) samples. Wrap it as such
+    // and let QImage convert it into the native 32 bit pixels, which uses
+    // SIMD code where the CPU supports it instead of a per pixel loop.
+    const QImage wrapped(reinterpret_cast<const uchar *>(pixels.constData()), width, rows, rowStride,
+                         channels == 4 ? QImage::Format_RGBA8888 : QImage::Format_RGB888);
+    return wrapped.convertToFormat(channels == 4 ? QImage::Format_ARGB32 : QImage::Format_RGB32);
 }
 
-void Notification::Private::sanitizeImage(QImage &image)
+QImage NotificationImageSource::decode(const QSize &maximumSize) const
 {
-    if (image.isNull()) {
-        return;
+    QImage image;
+
+    if (!path.isEmpty()) {
+        QImageReader reader(path);
+        reader.setAutoTransform(true);
+
+        const QSize imageSize = reader.size();
+        if (imageSize.isValid() && (imageSize.width() > maximumSize.width() || imageSize.height() > maximumSize.height())) {
+            const QSize thumbnailSize = imageSize.scaled(maximumSize, Qt::KeepAspectRatio);
+            reader.setScaledSize(thumbnailSize);
+        }
+
+        image = reader.read();
+    } else {
+        image = decodePixels();
     }
 
-    const QSize max = maximumImageSize();
-    if (image.size().width() > max.width()
-            || image.size().height() > max.height()) {
-        image = image.scaled(max, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    if (!image.isNull()
+            && (image.size().width() > maximumSize.width()
+                || image.size().height() > maximumSize.height())) {
+        image = image.scaled(maximumSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
     }
+
+    return image;
 }
 
 void Notification::Private::loadImagePath(const QString &path)
@@ -220,6 +374,7 @@ void Notification::Private::loadImagePath(const QString &path)
     // We're lenient and also allow local paths.
 
     image = QImage(); // clear
+    pendingImage.reset();
     icon.clear();
 
     QUrl imageUrl;
@@ -240,16 +395,22 @@ void Notification::Private::loadImagePath(const QString &path)
         return;
     }
 
-    QImageReader reader(imageUrl.toLocalFile());
-    reader.setAutoTransform(true);
+    // Reading the file is left to the model, or to the first caller of image()
+    QSharedPointer<NotificationImageSource> source(new NotificationImageSource);
+    source->path = imageUrl.toLocalFile();
+    pendingImage = source;
+}
 
-    const QSize imageSize = reader.size();
-    if (imageSize.isValid() && (imageSize.width() > maximumImageSize().width() || imageSize.height() > maximumImageSize().height())) {
-        const QSize thumbnailSize = imageSize.scaled(maximumImageSize(), Qt::KeepAspectRatio);
-        reader.setScaledSize(thumbnailSize);
+void Notification::Private::resolveImage()
+{
+    if (pendingImage) {
+        image = pendingImage->decode(maximumImageSize());
+        pendingImage.reset();
+        // the app_icon fallback is only needed if decoding failed
+        if (!image.isNull()) {
+            icon.clear();
+        }
     }
-
-    image = reader.read();
 }
 
 QString Notification::Private::defaultComponentName()
@@ -301,37 +462,22 @@ KService::Ptr Notification::Private::serviceForDesktopEntry(const QString &deskt
 
 void Notification::Private::setDesktopEntry(const QString &desktopEntry)
 {
-    QString serviceName;
+    const ApplicationInfo info = s_applicationInfoCache()->info(desktopEntry, notifyRcName);
+    const QString &serviceName = info.serviceName;
 
-    configurableService = false;
+    configurableService = info.configurableService;
 
-    KService::Ptr service = serviceForDesktopEntry(desktopEntry);
-    if (service) {
-        this->desktopEntry = service->desktopEntryName();
-        serviceName = service->name();
-        applicationIconName = service->icon();
-        configurableService = !service->noDisplay();
+    if (info.hasService) {
+        this->desktopEntry = info.desktopEntryName;
+        applicationIconName = info.serviceIconName;
     }
 
     const bool isDefaultEvent = (notifyRcName == defaultComponentName());
-    configurableNotifyRc = false;
-    if (!notifyRcName.isEmpty()) {
-        // Check whether the application actually has notifications we can configure
-        KConfig config(notifyRcName + QStringLiteral(".notifyrc"), KConfig::NoGlobals);
-        config.addConfigSources(QStandardPaths::locateAll(QStandardPaths::GenericDataLocation,
-                                QStringLiteral("knotifications5/") + notifyRcName + QStringLiteral(".notifyrc")));
-
-        KConfigGroup globalGroup(&config, "Global");
+    configurableNotifyRc = info.configurableNotifyRc;
 
-        const QString iconName = globalGroup.readEntry("IconName");
-
-        // also only overwrite application icon name for non-default events (or if we don't have a service icon)
-        if (!iconName.isEmpty() && (!isDefaultEvent || applicationIconName.isEmpty())) {
-            applicationIconName = iconName;
-        }
-
-        const QRegularExpression regexp(QStringLiteral("^Event/([^/]*)$"));
-        configurableNotifyRc = !config.groupList().filter(regexp).isEmpty();
+    // also only overwrite application icon name for non-default events (or if we don't have a service icon)
+    if (!info.notifyRcIconName.isEmpty() && (!isDefaultEvent || applicationIconName.isEmpty())) {
+        applicationIconName = info.notifyRcIconName;
     }
 
     // For default events we try to show the application name from the desktop entry if possible
@@ -406,11 +552,16 @@ void Notification::Private::processHints(const QVariantMap &hints)
         it = hints.find(QStringLiteral("icon_data"));
     }
 
+    // The image itself is decoded later, see AbstractNotificationsModel
     if (it != end) {
-        image = decodeNotificationSpecImageHint(it->value<QDBusArgument>());
+        const QSharedPointer<const NotificationImageSource> source = readNotificationSpecImageHint(it->value<QDBusArgument>());
+        if (source) {
+            image = QImage();
+            pendingImage = source;
+        }
     }
 
-    if (image.isNull()) {
+    if (image.isNull() && !pendingImage) {
         it = hints.find(QStringLiteral("image-path"));
         if (it == end) {
             it = hints.find(QStringLiteral("image_path"));
@@ -420,8 +571,6 @@ void Notification::Private::processHints(const QVariantMap &hints)
             loadImagePath(it->toString());
         }
     }
-
-    sanitizeImage(image);
 }
 
 void Notification::Private::setUrgency(Notifications::Urgency urgency)
@@ -548,17 +697,18 @@ QString Notification::icon() const
 void Notification::setIcon(const QString &icon)
 {
     d->loadImagePath(icon);
-    Private::sanitizeImage(d->image);
 }
 
 QImage Notification::image() const
 {
+    d->resolveImage();
     return d->image;
 }
 
 void Notification::setImage(const QImage &image)
 {
     d->image = image;
+    d->pendingImage.reset();
 }
 
 QString Notification::desktopEntry() const
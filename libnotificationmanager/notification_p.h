@@ -25,6 +25,7 @@
 #include <QScopedPointer>
 #include <QImage>
 #include <QList>
+#include <QSharedPointer>
 #include <QString>
 #include <QUrl>
 
@@ -35,6 +36,29 @@
 namespace NotificationManager
 {
 
+/**
+ * The image of a notification as received, either as raw pixels of the
+ * image-data hint or as the path of a local file.
+ *
+ * Decoding doesn't touch any other state and can happen on any thread.
+ */
+struct Q_DECL_HIDDEN NotificationImageSource
+{
+    QString path;
+
+    QByteArray pixels;
+    int width = 0;
+    int height = 0;
+    int rowStride = 0;
+    int channels = 0;
+
+    // Returns the image, scaled down to fit into maximumSize
+    QImage decode(const QSize &maximumSize) const;
+
+private:
+    QImage decodePixels() const;
+};
+
 class Q_DECL_HIDDEN Notification::Private
 {
 public:
@@ -42,10 +66,12 @@ public:
     ~Private();
 
     static QString sanitize(const QString &text);
-    static QImage decodeNotificationSpecImageHint(const QDBusArgument &arg);
-    static void sanitizeImage(QImage &image);
+    static QSharedPointer<const NotificationImageSource> readNotificationSpecImageHint(const QDBusArgument &arg);
 
     void loadImagePath(const QString &path);
+    // Decodes a pending image right away, for when it is needed before
+    // the model did so in the background
+    void resolveImage();
 
     static QString defaultComponentName();
     static QSize maximumImageSize();
@@ -71,6 +97,8 @@ public:
     // Can be theme icon name or path
     QString icon;
     QImage image;
+    // Set until the image has been decoded
+    QSharedPointer<const NotificationImageSource> pendingImage;
 
     QString applicationName;
     QString desktopEntry;
@@ -23,156 +23,317 @@
 
 #include <QDateTime>
 
+#include <algorithm>
+
 #include "notifications.h"
 
 using namespace NotificationManager;
 
-NotificationGroupingProxyModel::NotificationGroupingProxyModel(QObject *parent)
-    : QAbstractProxyModel(parent)
+int NotificationGroupRowMap::rowForId(quintptr id) const
 {
+    const auto it = std::lower_bound(m_ids.constBegin(), m_ids.constEnd(), id);
+
+    if (it != m_ids.constEnd() && *it == id) {
+        return (it - m_ids.constBegin());
+    }
 
+    return -1;
 }
 
-NotificationGroupingProxyModel::~NotificationGroupingProxyModel() = default;
+bool NotificationGroupRowMap::locate(int sourceRow, int *row, int *child) const
+{
+    if (sourceRow < 0 || sourceRow >= m_idForSourceRow.count()) {
+        return false;
+    }
+
+    const quintptr id = m_idForSourceRow.at(sourceRow);
+
+    if (!id) {
+        return false;
+    }
+
+    *row = rowForId(id);
+    *child = m_childForSourceRow.at(sourceRow);
+
+    return (*row != -1);
+}
 
-bool NotificationGroupingProxyModel::appsMatch(const QModelIndex &a, const QModelIndex &b) const
+void NotificationGroupRowMap::clear(int sourceRowCount)
 {
-    const QString aName = a.data(Notifications::ApplicationNameRole).toString();
-    const QString bName = b.data(Notifications::ApplicationNameRole).toString();
+    m_sourceRows.clear();
+    m_sourceRows.reserve(sourceRowCount);
+    m_offsets.clear();
+    m_offsets.reserve(sourceRowCount + 1);
+    m_offsets.append(0);
+    m_ids.clear();
+    m_ids.reserve(sourceRowCount);
+
+    m_idForSourceRow.fill(0, sourceRowCount);
+    m_childForSourceRow.fill(-1, sourceRowCount);
+}
 
-    const QString aDesktopEntry = a.data(Notifications::DesktopEntryRole).toString();
-    const QString bDesktopEntry = b.data(Notifications::DesktopEntryRole).toString();
+void NotificationGroupRowMap::appendRow(int sourceRow)
+{
+    const quintptr id = m_nextId++;
 
-    const QString aOriginName = a.data(Notifications::OriginNameRole).toString();
-    const QString bOriginName = b.data(Notifications::OriginNameRole).toString();
+    m_sourceRows.append(sourceRow);
+    m_offsets.append(m_sourceRows.count());
+    m_ids.append(id);
 
-    return !aName.isEmpty() && aName == bName
-            && aDesktopEntry == bDesktopEntry
-            && aOriginName == bOriginName;
+    setPosition(sourceRow, id, 0);
 }
 
-bool NotificationGroupingProxyModel::isGroup(int row) const
+void NotificationGroupRowMap::removeRow(int row)
 {
-    if (row < 0 || row >= rowMap.count()) {
-        return false;
+    const int first = m_offsets.at(row);
+    const int size = groupSize(row);
+    const quintptr id = m_ids.at(row);
+
+    for (int i = first; i < first + size; ++i) {
+        clearPosition(m_sourceRows.at(i), id);
+    }
+
+    m_sourceRows.remove(first, size);
+    m_offsets.remove(row + 1);
+
+    for (int i = row + 1; i < m_offsets.count(); ++i) {
+        m_offsets[i] -= size;
     }
 
-    return (rowMap.at(row)->count() > 1);
+    m_ids.remove(row);
 }
 
-bool NotificationGroupingProxyModel::tryToGroup(const QModelIndex &sourceIndex, bool silent)
+void NotificationGroupRowMap::appendChild(int row, int sourceRow)
 {
-    // Meat of the matter: Try to add this source row to a sub-list with source rows
-    // associated with the same application.
-    for (int i = 0; i < rowMap.count(); ++i) {
-        const QModelIndex &groupRep = sourceModel()->index(rowMap.at(i)->constFirst(), 0);
-
-        // Don't match a row with itself.
-        if (sourceIndex == groupRep) {
-            continue;
-        }
+    m_sourceRows.insert(m_offsets.at(row + 1), sourceRow);
 
-        if (appsMatch(sourceIndex, groupRep)) {
-            const QModelIndex parent = index(i, 0);
+    for (int i = row + 1; i < m_offsets.count(); ++i) {
+        ++m_offsets[i];
+    }
 
-            if (!silent) {
-                const int newIndex = rowMap.at(i)->count();
+    setPosition(sourceRow, m_ids.at(row), groupSize(row) - 1);
+}
 
-                if (newIndex == 1) {
-                    beginInsertRows(parent, 0, 1);
-                } else {
-                    beginInsertRows(parent, newIndex, newIndex);
-                }
-            }
+void NotificationGroupRowMap::removeChild(int row, int child)
+{
+    const int first = m_offsets.at(row);
 
-            rowMap[i]->append(sourceIndex.row());
+    clearPosition(m_sourceRows.at(first + child), m_ids.at(row));
+    m_sourceRows.remove(first + child);
 
-            if (!silent) {
-                endInsertRows();
+    for (int i = row + 1; i < m_offsets.count(); ++i) {
+        --m_offsets[i];
+    }
 
-                dataChanged(parent, parent);
-            }
+    // Later siblings move up by one.
+    for (int i = first + child; i < m_offsets.at(row + 1); ++i) {
+        --m_childForSourceRow[m_sourceRows.at(i)];
+    }
+}
 
-            return true;
+void NotificationGroupRowMap::insertSourceRows(int first, int count)
+{
+    for (int &sourceRow : m_sourceRows) {
+        if (sourceRow >= first) {
+            sourceRow += count;
         }
     }
 
-    return false;
+    if (first > m_idForSourceRow.count()) {
+        m_idForSourceRow.resize(first);
+        m_childForSourceRow.resize(first);
+    }
+
+    m_idForSourceRow.insert(first, count, 0);
+    m_childForSourceRow.insert(first, count, -1);
 }
 
-void NotificationGroupingProxyModel::adjustMap(int anchor, int delta)
+void NotificationGroupRowMap::removeSourceRows(int first, int count)
 {
-    for (int i = 0; i < rowMap.count(); ++i) {
-        QVector<int> *sourceRows = rowMap.at(i);
-        QMutableVectorIterator<int> it(*sourceRows);
+    for (int &sourceRow : m_sourceRows) {
+        if (sourceRow >= first + count) {
+            sourceRow -= count;
+        }
+    }
 
-        while (it.hasNext()) {
-            it.next();
+    if (first < m_idForSourceRow.count()) {
+        count = qMin(count, m_idForSourceRow.count() - first);
+        m_idForSourceRow.remove(first, count);
+        m_childForSourceRow.remove(first, count);
+    }
+}
 
-            if (it.value() >= anchor) {
-                it.setValue(it.value() + delta);
-            }
-        }
+void NotificationGroupRowMap::setPosition(int sourceRow, quintptr id, int child)
+{
+    if (sourceRow >= m_idForSourceRow.count()) {
+        m_idForSourceRow.resize(sourceRow + 1);
+        m_childForSourceRow.resize(sourceRow + 1);
+    }
+
+    m_idForSourceRow[sourceRow] = id;
+    m_childForSourceRow[sourceRow] = child;
+}
+
+void NotificationGroupRowMap::clearPosition(int sourceRow, quintptr id)
+{
+    if (sourceRow < m_idForSourceRow.count() && m_idForSourceRow.at(sourceRow) == id) {
+        m_idForSourceRow[sourceRow] = 0;
+        m_childForSourceRow[sourceRow] = -1;
     }
 }
 
-void NotificationGroupingProxyModel::rebuildMap()
+NotificationGroupingProxyModel::NotificationGroupingProxyModel(QObject *parent)
+    : QAbstractProxyModel(parent)
 {
-    qDeleteAll(rowMap);
-    rowMap.clear();
 
-    const int rows = sourceModel()->rowCount();
+}
 
-    rowMap.reserve(rows);
+NotificationGroupingProxyModel::~NotificationGroupingProxyModel() = default;
 
-    for (int i = 0; i < rows; ++i) {
-        rowMap.append(new QVector<int>{i});
+QString NotificationGroupingProxyModel::groupKey(const QModelIndex &sourceIndex)
+{
+    const QString name = sourceIndex.data(Notifications::ApplicationNameRole).toString();
+
+    // Notifications without an application name are never grouped
+    if (name.isEmpty()) {
+        return QString();
     }
 
-    checkGrouping(true /* silent */);
+    return name + QLatin1Char('\n')
+            + sourceIndex.data(Notifications::DesktopEntryRole).toString() + QLatin1Char('\n')
+            + sourceIndex.data(Notifications::OriginNameRole).toString();
 }
 
-void NotificationGroupingProxyModel::checkGrouping(bool silent)
+bool NotificationGroupingProxyModel::isGroup(int row) const
 {
-    for (int i = (rowMap.count()) - 1; i >= 0; --i) {
-        if (isGroup(i)) {
-            continue;
+    if (row < 0 || row >= rowMap.count()) {
+        return false;
+    }
+
+    return (rowMap.groupSize(row) > 1);
+}
+
+bool NotificationGroupingProxyModel::tryToGroup(const QModelIndex &sourceIndex, bool silent)
+{
+    // Meat of the matter: Add this source row to the top-level row of the
+    // same application, if there is one.
+    const QString key = groupKey(sourceIndex);
+    if (key.isEmpty()) {
+        return false;
+    }
+
+    const int row = rowMap.rowForId(groupForKey.value(key));
+    if (row == -1) {
+        return false;
+    }
+
+    const QModelIndex parent = index(row, 0);
+
+    if (!silent) {
+        const int newIndex = rowMap.groupSize(row);
+
+        if (newIndex == 1) {
+            beginInsertRows(parent, 0, 1);
+        } else {
+            beginInsertRows(parent, newIndex, newIndex);
         }
+    }
 
-        // FIXME support skip grouping hint, maybe?
-        // The new grouping keeps every notification separate, still, so perhaps we don't need to
+    rowMap.appendChild(row, sourceIndex.row());
 
-        if (tryToGroup(sourceModel()->index(rowMap.at(i)->constFirst(), 0), silent)) {
-            beginRemoveRows(QModelIndex(), i, i);
-            delete rowMap.takeAt(i); // Safe since we're iterating backwards.
-            endRemoveRows();
+    if (!silent) {
+        endInsertRows();
+
+        dataChanged(parent, parent);
+
+        // Signal children count change for all other items in the group.
+        if (rowMap.groupSize(row) > 2) {
+            emit dataChanged(index(0, 0, parent), index(rowMap.groupSize(row) - 2, 0, parent), {Notifications::GroupChildrenCountRole});
         }
     }
+
+    return true;
 }
 
-void NotificationGroupingProxyModel::formGroupFor(const QModelIndex &index)
+void NotificationGroupingProxyModel::appendRow(int sourceRow, bool silent)
 {
-    // Already in group or a group.
-    if (index.parent().isValid() || isGroup(index.row())) {
+    if (tryToGroup(sourceModel()->index(sourceRow, 0), silent)) {
         return;
     }
 
-    // We need to grab a source index as we may invalidate the index passed
-    // in through grouping.
-    const QModelIndex &sourceTarget = mapToSource(index);
+    if (!silent) {
+        beginInsertRows(QModelIndex(), rowMap.count(), rowMap.count());
+    }
 
-    for (int i = (rowMap.count() - 1); i >= 0; --i) {
-        const QModelIndex &sourceIndex = sourceModel()->index(rowMap.at(i)->constFirst(), 0);
+    rowMap.appendRow(sourceRow);
 
-        if (!appsMatch(sourceTarget, sourceIndex)) {
-            continue;
-        }
+    const QString key = groupKey(sourceModel()->index(sourceRow, 0));
+    if (!key.isEmpty()) {
+        const quintptr id = rowMap.id(rowMap.count() - 1);
+        groupForKey.insert(key, id);
+        keyForGroup.insert(id, key);
+    }
 
-        if (tryToGroup(sourceIndex)) {
-            beginRemoveRows(QModelIndex(), i, i);
-            delete rowMap.takeAt(i); // Safe since we're iterating backwards.
-            endRemoveRows();
-        }
+    if (!silent) {
+        endInsertRows();
+    }
+}
+
+void NotificationGroupingProxyModel::removeSourceRow(int sourceRow)
+{
+    int row = -1;
+    int child = -1;
+
+    if (!rowMap.locate(sourceRow, &row, &child)) {
+        return;
+    }
+
+    const int size = rowMap.groupSize(row);
+
+    // Remove top-level item.
+    if (size == 1) {
+        const quintptr id = rowMap.id(row);
+        groupForKey.remove(keyForGroup.take(id));
+
+        beginRemoveRows(QModelIndex(), row, row);
+        rowMap.removeRow(row);
+        endRemoveRows();
+    // Dissolve group.
+    } else if (size == 2) {
+        const QModelIndex parent = index(row, 0);
+        beginRemoveRows(parent, 0, 1);
+        rowMap.removeChild(row, child);
+        endRemoveRows();
+
+        // We're no longer a group parent.
+        dataChanged(parent, parent);
+    // Remove group member.
+    } else {
+        const QModelIndex parent = index(row, 0);
+        beginRemoveRows(parent, child, child);
+        rowMap.removeChild(row, child);
+        endRemoveRows();
+
+        // Various roles of the parent evaluate child data, and the
+        // child list has changed.
+        dataChanged(parent, parent);
+
+        // Signal children count change for all other items in the group.
+        emit dataChanged(index(0, 0, parent), index(rowMap.groupSize(row) - 1, 0, parent), {Notifications::GroupChildrenCountRole});
+    }
+}
+
+void NotificationGroupingProxyModel::rebuildMap()
+{
+    groupForKey.clear();
+    keyForGroup.clear();
+
+    const int rows = sourceModel()->rowCount();
+
+    rowMap.clear(rows);
+
+    for (int i = 0; i < rows; ++i) {
+        appendRow(i, true /* silent */);
     }
 }
 
@@ -200,17 +361,11 @@ void NotificationGroupingProxyModel::setSourceModel(QAbstractItemModel *sourceMo
                 return;
             }
 
-            adjustMap(start, (end - start) + 1);
+            rowMap.insertSourceRows(start, (end - start) + 1);
 
             for (int i = start; i <= end; ++i) {
-                if (!tryToGroup(this->sourceModel()->index(i, 0))) {
-                    beginInsertRows(QModelIndex(), rowMap.count(), rowMap.count());
-                    rowMap.append(new QVector<int>{i});
-                    endInsertRows();
-                }
+                appendRow(i);
             }
-
-            checkGrouping();
         });
 
         connect(sourceModel, &QAbstractItemModel::rowsAboutToBeRemoved, this, [this](const QModelIndex &parent, int first, int last) {
@@ -219,44 +374,8 @@ void NotificationGroupingProxyModel::setSourceModel(QAbstractItemModel *sourceMo
             }
 
             for (int i = first; i <= last; ++i) {
-                    for (int j = 0; j < rowMap.count(); ++j) {
-                        const QVector<int> *sourceRows = rowMap.at(j);
-                        const int mapIndex = sourceRows->indexOf(i);
-
-                        if (mapIndex != -1) {
-                            // Remove top-level item.
-                            if (sourceRows->count() == 1) {
-                                beginRemoveRows(QModelIndex(), j, j);
-                                delete rowMap.takeAt(j);
-                                endRemoveRows();
-                            // Dissolve group.
-                            } else if (sourceRows->count() == 2) {
-                                const QModelIndex parent = index(j, 0);
-                                beginRemoveRows(parent, 0, 1);
-                                rowMap[j]->remove(mapIndex);
-                                endRemoveRows();
-
-                                // We're no longer a group parent.
-                                dataChanged(parent, parent);
-                            // Remove group member.
-                            } else {
-                                const QModelIndex parent = index(j, 0);
-                                beginRemoveRows(parent, mapIndex, mapIndex);
-                                rowMap[j]->remove(mapIndex);
-                                endRemoveRows();
-
-                                // Various roles of the parent evaluate child data, and the
-                                // child list has changed.
-                                dataChanged(parent, parent);
-
-                                // Signal children count change for all other items in the group.
-                                emit dataChanged(index(0, 0, parent), index(rowMap.count() - 1, 0, parent), {Notifications::GroupChildrenCountRole});
-                            }
-
-                            break;
-                        }
-                    }
-                }
+                removeSourceRow(i);
+            }
         });
 
         connect(sourceModel, &QAbstractItemModel::rowsRemoved, this, [this](const QModelIndex &parent, int start, int end) {
@@ -264,9 +383,7 @@ void NotificationGroupingProxyModel::setSourceModel(QAbstractItemModel *sourceMo
                 return;
             }
 
-            adjustMap(start + 1, -((end - start) + 1));
-
-            checkGrouping();
+            rowMap.removeSourceRows(start, (end - start) + 1);
         });
 
 
@@ -309,12 +426,16 @@ QModelIndex NotificationGroupingProxyModel::index(int row, int column, const QMo
         return QModelIndex();
     }
 
-    if (parent.isValid() && row < rowMap.at(parent.row())->count()) {
-        return createIndex(row, column, rowMap.at(parent.row()));
+    if (parent.isValid()) {
+        if (parent.internalId() == 0 && parent.row() < rowMap.count() && row < rowMap.groupSize(parent.row())) {
+            return createIndex(row, column, rowMap.id(parent.row()));
+        }
+
+        return QModelIndex();
     }
 
     if (row < rowMap.count()) {
-        return createIndex(row, column, nullptr);
+        return createIndex(row, column, quintptr(0));
     }
 
     return QModelIndex();
@@ -322,16 +443,16 @@ QModelIndex NotificationGroupingProxyModel::index(int row, int column, const QMo
 
 QModelIndex NotificationGroupingProxyModel::parent(const QModelIndex &child) const
 {
-    if (child.internalPointer() == nullptr) {
+    if (child.internalId() == 0) {
         return QModelIndex();
     } else {
-        const int parentRow = rowMap.indexOf(static_cast<QVector<int> *>(child.internalPointer()));
+        const int parentRow = rowMap.rowForId(child.internalId());
 
         if (parentRow != -1) {
             return index(parentRow, 0);
         }
 
-        // If we were asked to find the parent for an internalPointer we can't
+        // If we were asked to find the parent for an internal id we can't
         // locate, we have corrupted data: This should not happen.
         Q_ASSERT(parentRow != -1);
     }
@@ -345,28 +466,24 @@ QModelIndex NotificationGroupingProxyModel::mapFromSource(const QModelIndex &sou
         return QModelIndex();
     }
 
-    for (int i = 0; i < rowMap.count(); ++i) {
-        const QVector<int> *sourceRows = rowMap.at(i);
-        const int childIndex = sourceRows->indexOf(sourceIndex.row());
-        const QModelIndex parent = index(i, 0);
-
-        if (childIndex == 0) {
-            // If the sub-list we found the source row in is larger than 1 (i.e. part
-            // of a group, map to the logical child item instead of the parent item
-            // the source row also stands in for. The parent is therefore unreachable
-            // from mapToSource().
-            if (isGroup(i)) {
-                return index(0, 0, parent);
-            // Otherwise map to the top-level item.
-            } else {
-                return parent;
-            }
-        } else if (childIndex != -1) {
-            return index(childIndex, 0, parent);
-        }
+    int row = -1;
+    int child = -1;
+
+    if (!rowMap.locate(sourceIndex.row(), &row, &child)) {
+        return QModelIndex();
     }
 
-    return QModelIndex();
+    const QModelIndex parent = index(row, 0);
+
+    // If the source row is part of a group, map to the logical child item
+    // instead of the parent item the source row may also stand in for. The
+    // parent is therefore unreachable from mapToSource().
+    if (isGroup(row)) {
+        return index(child, 0, parent);
+    }
+
+    // Otherwise map to the top-level item.
+    return parent;
 }
 
 QModelIndex NotificationGroupingProxyModel::mapToSource(const QModelIndex &proxyIndex) const
@@ -378,11 +495,12 @@ QModelIndex NotificationGroupingProxyModel::mapToSource(const QModelIndex &proxy
     const QModelIndex &parent = proxyIndex.parent();
 
     if (parent.isValid()) {
-        if (parent.row() < 0 || parent.row() >= rowMap.count()) {
+        if (parent.row() < 0 || parent.row() >= rowMap.count()
+                || proxyIndex.row() >= rowMap.groupSize(parent.row())) {
             return QModelIndex();
         }
 
-        return sourceModel()->index(rowMap.at(parent.row())->at(proxyIndex.row()), 0);
+        return sourceModel()->index(rowMap.sourceRow(parent.row(), proxyIndex.row()), 0);
     } else {
         // Group parents items therefore equate to the first child item; the source
         // row logically appears twice in the proxy.
@@ -391,11 +509,11 @@ QModelIndex NotificationGroupingProxyModel::mapToSource(const QModelIndex &proxy
         // has its Qt::DisplayRole mangled by data(), and it's more useful for trans-
         // lating dataChanged() from the source model.
         // NOTE we changed that to be last
-        if (rowMap.isEmpty()) { // FIXME
-            // How can this happen? (happens when closing a group)
+        if (proxyIndex.row() >= rowMap.count()) {
             return QModelIndex();
         }
-        return sourceModel()->index(rowMap.at(proxyIndex.row())->constLast(), 0);
+        const int row = proxyIndex.row();
+        return sourceModel()->index(rowMap.sourceRow(row, rowMap.groupSize(row) - 1), 0);
     }
 
     return QModelIndex();
@@ -418,7 +536,7 @@ int NotificationGroupingProxyModel::rowCount(const QModelIndex &parent) const
             return 0;
         }
 
-        const int rowCount = rowMap.at(parent.row())->count();
+        const int rowCount = rowMap.groupSize(parent.row());
 
         // If this sub-list in the map only has one entry, it's a plain item, not
         // parent to a group.
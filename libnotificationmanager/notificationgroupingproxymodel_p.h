@@ -23,10 +23,53 @@
 #pragma once
 
 #include <QAbstractProxyModel>
+#include <QHash>
+#include <QVector>
 
 namespace NotificationManager
 {
 
+/**
+ * Flat storage of the top-level rows of the grouping proxy and the source
+ * rows they consist of, along with the reverse mapping.
+ *
+ * Every top-level row has a stable id, used as internal id of its child
+ * indices. Ids are handed out in ascending order and rows are only ever
+ * appended, so the row of an id can be looked up by binary search.
+ */
+class Q_DECL_HIDDEN NotificationGroupRowMap
+{
+public:
+    int count() const { return m_ids.count(); }
+    int groupSize(int row) const { return m_offsets.at(row + 1) - m_offsets.at(row); }
+    int sourceRow(int row, int child = 0) const { return m_sourceRows.at(m_offsets.at(row) + child); }
+    quintptr id(int row) const { return m_ids.at(row); }
+
+    int rowForId(quintptr id) const;
+    bool locate(int sourceRow, int *row, int *child) const;
+
+    void clear(int sourceRowCount = 0);
+    void appendRow(int sourceRow);
+    void removeRow(int row);
+    void appendChild(int row, int sourceRow);
+    void removeChild(int row, int child);
+
+    void insertSourceRows(int first, int count);
+    void removeSourceRows(int first, int count);
+
+private:
+    void setPosition(int sourceRow, quintptr id, int child);
+    void clearPosition(int sourceRow, quintptr id);
+
+    QVector<int> m_sourceRows;
+    QVector<int> m_offsets = QVector<int>{0};
+    QVector<quintptr> m_ids;
+    quintptr m_nextId = 1;
+
+    QVector<quintptr> m_idForSourceRow;
+    QVector<int> m_childForSourceRow;
+};
+
 class NotificationGroupingProxyModel : public QAbstractProxyModel
 {
     Q_OBJECT
@@ -53,15 +96,19 @@ protected:
     //bool lessThan(const QModelIndex &source_left, const QModelIndex &source_right) const override;
 
 private:
-    bool appsMatch(const QModelIndex &a, const QModelIndex &b) const;
+    // Notifications with the same key are grouped, empty if it shouldn't be
+    static QString groupKey(const QModelIndex &sourceIndex);
     bool isGroup(int row) const;
     bool tryToGroup(const QModelIndex &sourceIndex, bool silent = false);
-    void adjustMap(int anchor, int delta);
+    void appendRow(int sourceRow, bool silent = false);
+    void removeSourceRow(int sourceRow);
     void rebuildMap();
-    void checkGrouping(bool silent = false);
-    void formGroupFor(const QModelIndex &index);
 
-    QVector<QVector<int> *> rowMap;
+    NotificationGroupRowMap rowMap;
+
+    // The top-level row notifications of an application are grouped into
+    QHash<QString /*groupKey*/, quintptr /*row id*/> groupForKey;
+    QHash<quintptr /*row id*/, QString /*groupKey*/> keyForGroup;
 
 };
 
@@ -0,0 +1,80 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ratelimiter_p.h"
+
+using namespace NotificationManager;
+
+// Only look for buckets to forget once there are this many
+static const int s_bucketCleanupThreshold = 64;
+
+RateLimiter::RateLimiter(int burst, double perSecond)
+    : m_burst(burst)
+    , m_perSecond(perSecond)
+{
+}
+
+void RateLimiter::setLimit(int burst, double perSecond)
+{
+    m_burst = burst;
+    m_perSecond = perSecond;
+    m_buckets.clear();
+}
+
+bool RateLimiter::consume(const QString &key, qint64 now)
+{
+    if (m_burst <= 0 || key.isEmpty()) {
+        return true;
+    }
+
+    // Forget about keys that are back to a full bucket anyway
+    if (m_buckets.count() > s_bucketCleanupThreshold) {
+        for (auto it = m_buckets.begin(); it != m_buckets.end();) {
+            refill(*it, now);
+            if (it->tokens >= m_burst) {
+                it = m_buckets.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    auto it = m_buckets.find(key);
+    if (it == m_buckets.end()) {
+        it = m_buckets.insert(key, Bucket{double(m_burst), now});
+    }
+    refill(*it, now);
+
+    if (it->tokens < 1) {
+        return false;
+    }
+
+    it->tokens -= 1;
+    return true;
+}
+
+int RateLimiter::count() const
+{
+    return m_buckets.count();
+}
+
+void RateLimiter::refill(Bucket &bucket, qint64 now) const
+{
+    bucket.tokens = qMin<double>(m_burst, bucket.tokens + (now - bucket.lastRefill) * m_perSecond / 1000);
+    bucket.lastRefill = now;
+}
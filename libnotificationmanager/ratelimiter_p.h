@@ -0,0 +1,67 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QString>
+
+namespace NotificationManager
+{
+
+/**
+ * Token bucket rate limiting per key.
+ *
+ * Every key may consume up to a burst of tokens at once, after which its
+ * bucket refills at a steady rate. Keys whose bucket is full again are
+ * forgotten, so keys that come and go don't pile up.
+ */
+class Q_DECL_HIDDEN RateLimiter
+{
+public:
+    /**
+     * @param burst The number of tokens available at once, 0 disables the limit
+     * @param perSecond The number of tokens that are refilled every second
+     */
+    explicit RateLimiter(int burst = 50, double perSecond = 5);
+
+    void setLimit(int burst, double perSecond);
+
+    /**
+     * Takes a token from the bucket of @p key at @p now, in milliseconds of
+     * a monotonic clock.
+     * @returns false if the bucket is empty
+     */
+    bool consume(const QString &key, qint64 now);
+
+    int count() const;
+
+private:
+    struct Bucket {
+        double tokens;
+        qint64 lastRefill;
+    };
+
+    void refill(Bucket &bucket, qint64 now) const;
+
+    int m_burst;
+    double m_perSecond;
+    QHash<QString, Bucket> m_buckets;
+};
+
+}
@@ -0,0 +1,59 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replacementqueue_p.h"
+
+using namespace NotificationManager;
+
+ReplacementQueue::ReplacementQueue(int interval, QObject *parent)
+    : QObject(parent)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(interval);
+    connect(&m_timer, &QTimer::timeout, this, &ReplacementQueue::emitReplacements);
+}
+
+ReplacementQueue::~ReplacementQueue() = default;
+
+void ReplacementQueue::queue(const Notification &notification, const QStringList &actions, const QVariantMap &hints)
+{
+    m_replacements.insert(notification.id(), Replacement{notification, actions, hints});
+    if (!m_timer.isActive()) {
+        m_timer.start();
+    }
+}
+
+void ReplacementQueue::discard(uint notificationId)
+{
+    m_replacements.remove(notificationId);
+}
+
+bool ReplacementQueue::isQueued(uint notificationId) const
+{
+    return m_replacements.contains(notificationId);
+}
+
+void ReplacementQueue::emitReplacements()
+{
+    QHash<uint, Replacement> replacements;
+    replacements.swap(m_replacements);
+
+    for (const Replacement &replacement : qAsConst(replacements)) {
+        emit replaced(replacement.notification, replacement.actions, replacement.hints);
+    }
+}
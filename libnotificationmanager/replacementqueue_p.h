@@ -0,0 +1,72 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <QVariantMap>
+
+#include "notification.h"
+
+namespace NotificationManager
+{
+
+/**
+ * Coalesces replacements of notifications.
+ *
+ * Applications updating e.g. a progress in quick succession only need their
+ * latest state shown. Replacements queued within one interval are emitted
+ * together once it has passed, only the latest one per notification.
+ */
+class Q_DECL_HIDDEN ReplacementQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ReplacementQueue(int interval = 16, QObject *parent = nullptr);
+    ~ReplacementQueue() override;
+
+    /**
+     * Queues @p notification to replace the one with the same id,
+     * superseding an earlier replacement that is still queued.
+     */
+    void queue(const Notification &notification, const QStringList &actions, const QVariantMap &hints);
+    // Drops the queued replacement of the notification, if any
+    void discard(uint notificationId);
+    bool isQueued(uint notificationId) const;
+
+Q_SIGNALS:
+    void replaced(const Notification &notification, const QStringList &actions, const QVariantMap &hints);
+
+private:
+    void emitReplacements();
+
+    struct Replacement {
+        Notification notification;
+        QStringList actions;
+        QVariantMap hints;
+    };
+
+    QHash<uint /*notificationId*/, Replacement> m_replacements;
+    QTimer m_timer;
+};
+
+}
@@ -70,6 +70,8 @@ ServerInfo *Server::currentOwner() const
 
 void Server::closeNotification(uint notificationId, CloseReason reason)
 {
+    d->notificationClosed(notificationId);
+
     emit notificationRemoved(notificationId, reason);
 
     emit d->NotificationClosed(notificationId, static_cast<uint>(reason)); // tell on DBus
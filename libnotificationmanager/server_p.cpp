@@ -33,6 +33,7 @@
 #include "utils_p.h"
 
 #include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
 #include <QDBusServiceWatcher>
 
 #include <KConfigGroup>
@@ -42,10 +43,17 @@
 
 using namespace NotificationManager;
 
+// How long a notification watcher may take to reply before it's backed off
+static const int s_watcherCallTimeout = 5000;
+static const int s_maximumWatcherBackoff = 60000;
+// How many calls are kept for a watcher that is backed off
+static const int s_maximumWatcherQueue = 256;
+
 ServerPrivate::ServerPrivate(QObject *parent)
     : QObject(parent)
     , m_inhibitionWatcher(new QDBusServiceWatcher(this))
     , m_notificationWatchers (new QDBusServiceWatcher(this))
+    , m_senderWatcher(new QDBusServiceWatcher(this))
 {
     m_inhibitionWatcher->setConnection(QDBusConnection::sessionBus());
     m_inhibitionWatcher->setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
@@ -53,9 +61,21 @@ ServerPrivate::ServerPrivate(QObject *parent)
 
     m_notificationWatchers->setConnection(QDBusConnection::sessionBus());
     m_notificationWatchers->setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
-    connect(m_notificationWatchers, &QDBusServiceWatcher::serviceUnregistered, [=](const QString &service) {
-        m_notificationWatchers->removeWatchedService(service);
+    connect(m_notificationWatchers, &QDBusServiceWatcher::serviceUnregistered, this, &ServerPrivate::removeWatcher);
+
+    m_senderWatcher->setConnection(QDBusConnection::sessionBus());
+    m_senderWatcher->setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(m_senderWatcher, &QDBusServiceWatcher::serviceUnregistered, this, &ServerPrivate::onSenderUnregistered);
+
+    m_clock.start();
+
+    connect(&m_replacements, &ReplacementQueue::replaced, this, [this](const Notification &notification, const QStringList &actions, const QVariantMap &hints) {
+        emit static_cast<Server*>(parent())->notificationReplaced(notification.id(), notification);
+        notifyWatchers(notification.id(), notification.id(), notification, actions, hints);
     });
+
+    m_watcherDispatchTimer.setSingleShot(true);
+    connect(&m_watcherDispatchTimer, &QTimer::timeout, this, &ServerPrivate::dispatchWatcherCalls);
 }
 
 ServerPrivate::~ServerPrivate() = default;
@@ -127,6 +147,11 @@ bool ServerPrivate::init()
     qCDebug(NOTIFICATIONMANAGER) << "Registered Notification service on DBus";
 
     KConfigGroup config(KSharedConfig::openConfig(), QStringLiteral("Notifications"));
+
+    // How many notifications a single application may send at once, and how
+    // many more it may send every second afterwards. A burst of 0 disables the limit.
+    m_rateLimiter.setLimit(config.readEntry("RateLimitBurst", 50), config.readEntry("RateLimitPerSecond", 5.0));
+
     const bool broadcastsEnabled = config.readEntry("ListenForBroadcasts", false);
 
     if (broadcastsEnabled) {
@@ -147,6 +172,17 @@ uint ServerPrivate::Notify(const QString &app_name, uint replaces_id, const QStr
                            const QVariantMap &hints, int timeout)
 {
     const bool wasReplaced = replaces_id > 0;
+
+    // Updates of existing notifications are coalesced below instead. Replacing
+    // an id that is gone, or was never handed out, adds a notification though.
+    if (!(wasReplaced && m_liveNotifications.contains(replaces_id)) && !consumeToken(message().service())) {
+        qCDebug(NOTIFICATIONMANAGER) << "Discarding notification from" << message().service() << "exceeding the rate limit";
+
+        sendErrorReply(QStringLiteral("org.freedesktop.Notifications.Error.ExcessNotificationGeneration"),
+                       QStringLiteral("Created too many notifications in quick succession"));
+        return 0;
+    }
+
     uint notificationId = 0;
     if (wasReplaced) {
         notificationId = replaces_id;
@@ -174,23 +210,21 @@ uint ServerPrivate::Notify(const QString &app_name, uint replaces_id, const QStr
 
     // If we didn't get a pixmap, load the app_icon instead
     if (notification.d->image.isNull()) {
-        notification.setIcon(app_icon);
+        if (!notification.d->pendingImage) {
+            notification.setIcon(app_icon);
+        } else if (!app_icon.contains(QLatin1Char('/'))) {
+            // Keep the icon name around in case the pending image fails to decode
+            notification.d->icon = app_icon;
+        }
     }
 
-    uint pid = 0;
-    if (notification.desktopEntry().isEmpty() || notification.applicationName().isEmpty()) {
-        if (notification.desktopEntry().isEmpty() && notification.applicationName().isEmpty()) {
-            qCInfo(NOTIFICATIONMANAGER) << "Notification from service" << message().service() << "didn't contain any identification information, this is an application bug!";
-        }
-        QDBusReply<uint> pidReply = connection().interface()->servicePid(message().service());
-        if (pidReply.isValid()) {
-            pid = pidReply.value();
-        }
+    if (notification.desktopEntry().isEmpty() && notification.applicationName().isEmpty()) {
+        qCInfo(NOTIFICATIONMANAGER) << "Notification from service" << message().service() << "didn't contain any identification information, this is an application bug!";
     }
 
     // No desktop entry? Try to read the BAMF_DESKTOP_FILE_HINT in the environment of snaps
-    if (notification.desktopEntry().isEmpty() && pid > 0) {
-        const QString desktopEntry = Utils::desktopEntryFromPid(pid);
+    if (notification.desktopEntry().isEmpty()) {
+        const QString desktopEntry = senderDesktopEntry(message().service());
         if (!desktopEntry.isEmpty()) {
             qCDebug(NOTIFICATIONMANAGER) << "Resolved notification to be from desktop entry" << desktopEntry;
             notification.setDesktopEntry(desktopEntry);
@@ -207,8 +241,8 @@ uint ServerPrivate::Notify(const QString &app_name, uint replaces_id, const QStr
     }
 
     // No application name? Try to figure out the process name using the sender's PID
-    if (notification.applicationName().isEmpty() && pid > 0) {
-        const QString processName = Utils::processNameFromPid(pid);
+    if (notification.applicationName().isEmpty()) {
+        const QString processName = senderProcessName(message().service());
         if (!processName.isEmpty()) {
             qCDebug(NOTIFICATIONMANAGER) << "Resolved notification to be from process name" << processName;
             notification.setApplicationName(processName);
@@ -232,55 +266,262 @@ uint ServerPrivate::Notify(const QString &app_name, uint replaces_id, const QStr
     }
 
     m_lastNotification = notification;
+    m_liveNotifications.insert(notificationId);
 
     if (wasReplaced) {
         notification.resetUpdated();
-        emit static_cast<Server*>(parent())->notificationReplaced(replaces_id, notification);
+        m_replacements.queue(notification, actions, hints);
     } else {
         emit static_cast<Server*>(parent())->notificationAdded(notification);
+        notifyWatchers(notificationId, replaces_id, notification, actions, hints);
+    }
+
+    return notificationId;
+}
+
+ServerPrivate::SenderIdentity *ServerPrivate::senderIdentity(const QString &service)
+{
+    if (service.isEmpty()) {
+        return nullptr;
+    }
+
+    auto it = m_senderIdentities.find(service);
+    if (it != m_senderIdentities.end()) {
+        return &*it;
     }
 
+    // Don't remember senders we cannot identify, the name might not even
+    // be on the bus anymore and would then never be unregistered
+    QDBusReply<uint> pidReply = QDBusConnection::sessionBus().interface()->servicePid(service);
+    if (!pidReply.isValid() || pidReply.value() == 0) {
+        return nullptr;
+    }
+
+    it = m_senderIdentities.insert(service, SenderIdentity());
+    it->pid = pidReply.value();
+
+    // Unique names are never reused, forget about the sender once it's gone
+    m_senderWatcher->addWatchedService(service);
+
+    return &*it;
+}
+
+QString ServerPrivate::senderDesktopEntry(const QString &service)
+{
+    SenderIdentity *identity = senderIdentity(service);
+    if (!identity) {
+        return QString();
+    }
+    if (!identity->desktopEntryResolved) {
+        identity->desktopEntry = Utils::desktopEntryFromPid(identity->pid);
+        identity->desktopEntryResolved = true;
+    }
+    return identity->desktopEntry;
+}
+
+QString ServerPrivate::senderProcessName(const QString &service)
+{
+    SenderIdentity *identity = senderIdentity(service);
+    if (!identity) {
+        return QString();
+    }
+    if (!identity->processNameResolved) {
+        identity->processName = Utils::processNameFromPid(identity->pid);
+        identity->processNameResolved = true;
+    }
+    return identity->processName;
+}
+
+void ServerPrivate::onSenderUnregistered(const QString &service)
+{
+    m_senderWatcher->removeWatchedService(service);
+    m_senderIdentities.remove(service);
+}
+
+bool ServerPrivate::consumeToken(const QString &sender)
+{
+    return m_rateLimiter.consume(sender, m_clock.elapsed());
+}
+
+void ServerPrivate::notificationClosed(uint notificationId)
+{
+    m_replacements.discard(notificationId);
+    m_liveNotifications.remove(notificationId);
+}
+
+void ServerPrivate::notifyWatchers(uint notificationId, uint replacesId, const Notification &notification,
+                                   const QStringList &actions, const QVariantMap &hints)
+{
     // currently we dispatch all notification, this is ugly
     // TODO: come up with proper authentication/user selection
-    for (const QString &service : m_notificationWatchers->watchedServices()) {
-        QDBusMessage msg = QDBusMessage::createMethodCall(
-            service,
-            QStringLiteral("/NotificationWatcher"),
-            QStringLiteral("org.kde.NotificationWatcher"),
-            QStringLiteral("Notify")
-        );
-        msg.setArguments({
-            notificationId,
-            notification.applicationName(),
-            replaces_id,
-            notification.applicationIconName(),
-            notification.summary(),
-            // we pass raw body data since this data goes through another sanitization
-            // in WatchedNotificationsModel when notification object is created.
-            notification.rawBody(),
-            actions,
-            hints,
-            notification.timeout()
-        });
-        QDBusConnection::sessionBus().call(msg, QDBus::NoBlock);
+    if (m_watchers.isEmpty()) {
+        return;
     }
 
-    return notificationId;
+    queueWatcherCall(notificationId, QStringLiteral("Notify"), {
+        notificationId,
+        notification.applicationName(),
+        replacesId,
+        notification.applicationIconName(),
+        notification.summary(),
+        // we pass raw body data since this data goes through another sanitization
+        // in WatchedNotificationsModel when notification object is created.
+        notification.rawBody(),
+        actions,
+        hints,
+        notification.timeout()
+    });
+}
+
+void ServerPrivate::queueWatcherCall(uint notificationId, const QString &method, const QVariantList &arguments)
+{
+    const bool close = (method == QLatin1String("CloseNotification"));
+
+    for (Watcher &watcher : m_watchers) {
+        bool queue = true;
+
+        // Only the latest state of a notification the watcher hasn't been told about yet matters
+        for (int i = 0; i < watcher.queue.count(); ++i) {
+            WatcherCall &call = watcher.queue[i];
+            if (call.notificationId != notificationId || call.method != QLatin1String("Notify")) {
+                continue;
+            }
+
+            // replaces_id of the call that is already queued, 0 if it adds the notification
+            const QVariant replacesId = call.arguments.at(2);
+
+            if (close) {
+                watcher.queue.remove(i);
+                // Nothing to close if the watcher never saw the notification
+                queue = replacesId.toUInt() != 0;
+            } else {
+                call.arguments = arguments;
+                call.arguments[2] = replacesId;
+                queue = false;
+            }
+            break;
+        }
+
+        if (!queue) {
+            continue;
+        }
+
+        if (watcher.queue.count() >= s_maximumWatcherQueue) {
+            watcher.queue.removeFirst();
+        }
+        watcher.queue.append(WatcherCall{notificationId, method, arguments});
+    }
+
+    scheduleWatcherDispatch(16); // about a frame
+}
+
+void ServerPrivate::scheduleWatcherDispatch(int delay)
+{
+    // A backed off watcher must not hold up the others
+    if (!m_watcherDispatchTimer.isActive() || m_watcherDispatchTimer.remainingTime() > delay) {
+        m_watcherDispatchTimer.start(delay);
+    }
+}
+
+void ServerPrivate::dispatchWatcherCalls()
+{
+    const qint64 now = m_clock.elapsed();
+    qint64 nextDispatch = -1;
+
+    for (auto it = m_watchers.begin(); it != m_watchers.end(); ++it) {
+        Watcher &watcher = *it;
+
+        // Calls keep being coalesced while the watcher is busy with the previous batch
+        if (watcher.queue.isEmpty() || watcher.awaitingReply) {
+            continue;
+        }
+
+        if (watcher.backoffUntil > now) {
+            if (nextDispatch == -1 || watcher.backoffUntil < nextDispatch) {
+                nextDispatch = watcher.backoffUntil;
+            }
+            continue;
+        }
+
+        const QString service = it.key();
+
+        for (int i = 0; i < watcher.queue.count(); ++i) {
+            const WatcherCall &call = watcher.queue.at(i);
+
+            QDBusMessage msg = QDBusMessage::createMethodCall(
+                service,
+                QStringLiteral("/NotificationWatcher"),
+                QStringLiteral("org.kde.NotificationWatcher"),
+                call.method
+            );
+            msg.setArguments(call.arguments);
+            msg.setAutoStartService(false);
+
+            // Calls are handled in order, so the reply to the last one tells
+            // whether the watcher kept up with the whole batch
+            if (i < watcher.queue.count() - 1) {
+                QDBusConnection::sessionBus().send(msg);
+                continue;
+            }
+
+            auto *callWatcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(msg, s_watcherCallTimeout), this);
+            connect(callWatcher, &QDBusPendingCallWatcher::finished, this, [this, service](QDBusPendingCallWatcher *call) {
+                onWatcherCallFinished(service, call);
+            });
+        }
+
+        watcher.queue.clear();
+        watcher.awaitingReply = true;
+    }
+
+    if (nextDispatch != -1) {
+        scheduleWatcherDispatch(nextDispatch - now);
+    }
+}
+
+void ServerPrivate::onWatcherCallFinished(const QString &service, QDBusPendingCallWatcher *call)
+{
+    call->deleteLater();
+
+    auto it = m_watchers.find(service);
+    if (it == m_watchers.end()) {
+        return;
+    }
+
+    it->awaitingReply = false;
+
+    const QDBusError::ErrorType error = call->isError() ? call->error().type() : QDBusError::NoError;
+
+    if (error == QDBusError::ServiceUnknown || error == QDBusError::UnknownObject) {
+        removeWatcher(service);
+        return;
+    }
+
+    if (error == QDBusError::NoReply || error == QDBusError::Timeout || error == QDBusError::TimedOut) {
+        ++it->failures;
+        const int backoff = qMin(s_watcherCallTimeout << qMin(it->failures - 1, 4), s_maximumWatcherBackoff);
+        it->backoffUntil = m_clock.elapsed() + backoff;
+        qCDebug(NOTIFICATIONMANAGER) << "Notification watcher" << service << "isn't responding, backing off for" << backoff << "ms";
+    } else {
+        it->failures = 0;
+        it->backoffUntil = 0;
+    }
+
+    if (!it->queue.isEmpty()) {
+        scheduleWatcherDispatch(qMax<qint64>(0, it->backoffUntil - m_clock.elapsed()));
+    }
+}
+
+void ServerPrivate::removeWatcher(const QString &service)
+{
+    m_notificationWatchers->removeWatchedService(service);
+    m_watchers.remove(service);
 }
 
 void ServerPrivate::CloseNotification(uint id)
 {
-    for (const QString &service : m_notificationWatchers->watchedServices()) {
-        QDBusMessage msg = QDBusMessage::createMethodCall(
-            service,
-            QStringLiteral("/NotificationWatcher"),
-            QStringLiteral("org.kde.NotificationWatcher"),
-            QStringLiteral("CloseNotification")
-        );
-        msg.setArguments({
-            id
-        });
-        QDBusConnection::sessionBus().call(msg, QDBus::NoBlock);
+    if (!m_watchers.isEmpty()) {
+        queueWatcherCall(id, QStringLiteral("CloseNotification"), {id});
     }
     // spec says "If the notification no longer exists, an empty D-BUS Error message is sent back."
     static_cast<Server*>(parent())->closeNotification(id, Server::CloseReason::Revoked);
@@ -359,9 +600,11 @@ uint ServerPrivate::add(const Notification &notification)
     if (notification.id() == 0) {
         ++m_highestNotificationId;
         notification.d->id = m_highestNotificationId;
+        m_liveNotifications.insert(notification.id());
 
         emit static_cast<Server*>(parent())->notificationAdded(notification);
     } else {
+        m_replacements.discard(notification.id());
         emit static_cast<Server*>(parent())->notificationReplaced(notification.id(), notification);
     }
 
@@ -540,11 +783,14 @@ void ServerPrivate::clearExternalInhibitions()
 void ServerPrivate::RegisterWatcher()
 {
     m_notificationWatchers->addWatchedService(message().service());
+    if (!m_watchers.contains(message().service())) {
+        m_watchers.insert(message().service(), Watcher());
+    }
 }
 
 void ServerPrivate::UnRegisterWatcher()
 {
-    m_notificationWatchers->removeWatchedService(message().service());
+    removeWatcher(message().service());
 }
 
 void ServerPrivate::InvokeAction(uint id, const QString& actionKey)
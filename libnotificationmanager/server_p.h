@@ -22,10 +22,18 @@
 
 #include <QObject>
 #include <QDBusContext>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
 #include <QStringList>
+#include <QTimer>
+#include <QVector>
 
 #include "notification.h"
+#include "ratelimiter_p.h"
+#include "replacementqueue_p.h"
 
+class QDBusPendingCallWatcher;
 class QDBusServiceWatcher;
 
 struct Inhibition
@@ -112,6 +120,9 @@ public: // stuff used by public class
     QList<Inhibition> externalInhibitions() const;
     void clearExternalInhibitions();
 
+    // Forgets about a notification that was closed, along with a replacement of it that is yet to be emitted
+    void notificationClosed(uint notificationId);
+
     bool m_valid = false;
     uint m_highestNotificationId = 1;
 
@@ -119,6 +130,42 @@ private slots:
     void onBroadcastNotification(const QMap<QString, QVariant> &properties);
 
 private:
+    // What we know about the process behind a unique DBus name
+    struct SenderIdentity {
+        uint pid = 0;
+        bool desktopEntryResolved = false;
+        QString desktopEntry;
+        bool processNameResolved = false;
+        QString processName;
+    };
+
+    struct WatcherCall {
+        uint notificationId;
+        QString method;
+        QVariantList arguments;
+    };
+
+    struct Watcher {
+        QVector<WatcherCall> queue;
+        bool awaitingReply = false;
+        int failures = 0;
+        qint64 backoffUntil = 0;
+    };
+
+    SenderIdentity *senderIdentity(const QString &service);
+    QString senderDesktopEntry(const QString &service);
+    QString senderProcessName(const QString &service);
+    void onSenderUnregistered(const QString &service);
+
+    bool consumeToken(const QString &sender);
+    void notifyWatchers(uint notificationId, uint replacesId, const Notification &notification,
+                        const QStringList &actions, const QVariantMap &hints);
+    void queueWatcherCall(uint notificationId, const QString &method, const QVariantList &arguments);
+    void scheduleWatcherDispatch(int delay);
+    void dispatchWatcherCalls();
+    void onWatcherCallFinished(const QString &service, QDBusPendingCallWatcher *call);
+    void removeWatcher(const QString &service);
+
     void onServiceOwnershipLost(const QString &serviceName);
     void onInhibitionServiceUnregistered(const QString &serviceName);
     void onInhibitedChanged(); // emit DBus change signal
@@ -129,6 +176,7 @@ private:
 
     QDBusServiceWatcher *m_inhibitionWatcher = nullptr;
     QDBusServiceWatcher *m_notificationWatchers = nullptr;
+    QDBusServiceWatcher *m_senderWatcher = nullptr;
     uint m_highestInhibitionCookie = 0;
     QHash<uint /*cookie*/, Inhibition> m_externalInhibitions;
     QHash<uint /*cookie*/, QString> m_inhibitionServices;
@@ -137,6 +185,24 @@ private:
 
     Notification m_lastNotification;
 
+    QElapsedTimer m_clock;
+
+    // Identity of senders resolved through their PID, by unique DBus name
+    QHash<QString /*service*/, SenderIdentity> m_senderIdentities;
+
+    // Rate limiting of new notifications per sender
+    RateLimiter m_rateLimiter;
+    // Notifications that weren't closed yet, only replacing those is exempt from the rate limit
+    QSet<uint> m_liveNotifications;
+
+    // Replacements are emitted at most once per frame
+    ReplacementQueue m_replacements;
+
+    // Calls to notification watchers are queued and sent in batches, a watcher
+    // that doesn't reply in time is skipped for a while
+    QHash<QString /*service*/, Watcher> m_watchers;
+    QTimer m_watcherDispatchTimer;
+
 };
 
 } // namespace NotificationManager
@@ -0,0 +1,105 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timerwheel_p.h"
+
+using namespace NotificationManager;
+
+TimerWheel::TimerWheel(int tickInterval, int slotCount, QObject *parent)
+    : QObject(parent)
+    , m_tickInterval(tickInterval)
+    , m_slots(slotCount)
+{
+    m_timer.setInterval(tickInterval);
+    connect(&m_timer, &QTimer::timeout, this, &TimerWheel::tick);
+}
+
+TimerWheel::~TimerWheel() = default;
+
+void TimerWheel::schedule(uint id, int msecs)
+{
+    cancel(id);
+
+    const int ticks = qMax(1, (msecs + m_tickInterval - 1) / m_tickInterval);
+
+    Entry entry;
+    entry.slot = (m_currentSlot + ticks) % m_slots.count();
+    entry.rounds = (ticks - 1) / m_slots.count();
+
+    m_slots[entry.slot].insert(id);
+    m_entries.insert(id, entry);
+
+    if (!m_timer.isActive()) {
+        m_timer.start();
+    }
+}
+
+void TimerWheel::cancel(uint id)
+{
+    auto it = m_entries.find(id);
+    if (it == m_entries.end()) {
+        return;
+    }
+
+    m_slots[it->slot].remove(id);
+    m_entries.erase(it);
+
+    if (m_entries.isEmpty()) {
+        m_timer.stop();
+    }
+}
+
+bool TimerWheel::isScheduled(uint id) const
+{
+    return m_entries.contains(id);
+}
+
+int TimerWheel::count() const
+{
+    return m_entries.count();
+}
+
+void TimerWheel::tick()
+{
+    m_currentSlot = (m_currentSlot + 1) % m_slots.count();
+
+    QVector<uint> due;
+
+    QSet<uint> &slot = m_slots[m_currentSlot];
+    for (auto it = slot.begin(); it != slot.end();) {
+        Entry &entry = m_entries[*it];
+        if (entry.rounds > 0) {
+            --entry.rounds;
+            ++it;
+            continue;
+        }
+
+        due.append(*it);
+        m_entries.remove(*it);
+        it = slot.erase(it);
+    }
+
+    if (m_entries.isEmpty()) {
+        m_timer.stop();
+    }
+
+    // Handlers may schedule or cancel other ids
+    for (uint id : qAsConst(due)) {
+        emit timeout(id);
+    }
+}
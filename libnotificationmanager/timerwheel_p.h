@@ -0,0 +1,75 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3, or any
+ * later version accepted by the membership of KDE e.V. (or its
+ * successor approved by the membership of KDE e.V.), which shall
+ * act as a proxy defined in Section 6 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <QVector>
+
+namespace NotificationManager
+{
+
+/**
+ * Times out any number of ids using a single timer.
+ *
+ * Ids are hashed into the slots of a wheel by their deadline. The timer
+ * only ticks while anything is scheduled and then advances the wheel by one
+ * slot per tick, so timeouts are only as precise as the tick interval.
+ * This is meant for long timeouts where that doesn't matter.
+ */
+class Q_DECL_HIDDEN TimerWheel : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TimerWheel(int tickInterval = 1000, int slotCount = 64, QObject *parent = nullptr);
+    ~TimerWheel() override;
+
+    /**
+     * Schedules @p id to time out after @p msecs, replacing an earlier
+     * schedule of it.
+     */
+    void schedule(uint id, int msecs);
+    void cancel(uint id);
+    bool isScheduled(uint id) const;
+
+    int count() const;
+
+Q_SIGNALS:
+    void timeout(uint id);
+
+private:
+    void tick();
+
+    struct Entry {
+        int slot;
+        // Full turns of the wheel left before it's due
+        int rounds;
+    };
+
+    int m_tickInterval;
+    int m_currentSlot = 0;
+    QVector<QSet<uint>> m_slots;
+    QHash<uint, Entry> m_entries;
+    QTimer m_timer;
+};
+
+}
@@ -34,6 +34,7 @@
 #include <KConcatenateRowsProxyModel>
 
 #include <KProcessList>
+#include <KSycoca>
 
 using namespace NotificationManager;
 
@@ -126,3 +127,15 @@ bool Utils::isDBusMaster()
 {
     return qApp->property("_plasma_dbus_master").toBool();
 }
+
+void Utils::connectToApplicationsChanged(QObject *context, const std::function<void()> &callback)
+{
+    void (KSycoca::*myDatabaseChangeSignal)(const QStringList &) = &KSycoca::databaseChanged;
+    QObject::connect(KSycoca::self(), myDatabaseChangeSignal, context, [callback](const QStringList &changedResources) {
+        if (changedResources.contains(QLatin1String("services"))
+            || changedResources.contains(QLatin1String("apps"))
+            || changedResources.contains(QLatin1String("xdgdata-apps"))) {
+            callback();
+        }
+    });
+}
@@ -23,8 +23,11 @@
 #include <QString>
 #include <QModelIndex>
 
+#include <functional>
+
 class QAbstractItemModel;
 class QDBusConnection;
+class QObject;
 
 namespace NotificationManager
 {
@@ -42,6 +45,9 @@ QModelIndex mapToModel(const QModelIndex &idx, const QAbstractItemModel *sourceM
 
 bool isDBusMaster();
 
+// Calls the callback whenever KSycoca reports changed application services, as long as context exists
+void connectToApplicationsChanged(QObject *context, const std::function<void()> &callback);
+
 } // namespace Utils
 
 } // namespace NotificationManager
@@ -0,0 +1,91 @@
+/********************************************************************
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) version 3, or any
+later version accepted by the membership of KDE e.V. (or its
+successor approved by the membership of KDE e.V.), which shall
+act as a proxy defined in Section 6 of version 3 of the license.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "appdatastore_p.h"
+#include "tasktools_p.h"
+
+#include <QHash>
+#include <QPair>
+#include <QWeakPointer>
+
+namespace TaskManager
+{
+
+class Q_DECL_HIDDEN AppDataStoreData : public QObject
+{
+public:
+    AppDataStoreData();
+
+    // Keyed by launcher URL and fallback icon name.
+    QHash<QPair<QUrl, QString>, QWeakPointer<const AppData>> entries;
+};
+
+Q_GLOBAL_STATIC(AppDataStoreData, appDataStoreData)
+
+AppDataStoreData::AppDataStoreData()
+{
+    connectToApplicationsChanged(this, [this] {
+        entries.clear();
+    });
+}
+
+AppDataStore::Ptr AppDataStore::appData(const QUrl &url, const QString &fallbackIconName)
+{
+    AppDataStoreData *store = appDataStoreData();
+    const QPair<QUrl, QString> key(url, fallbackIconName);
+
+    auto it = store->entries.find(key);
+
+    if (it != store->entries.end()) {
+        const Ptr data = it->toStrongRef();
+
+        if (data) {
+            return data;
+        }
+
+        store->entries.erase(it);
+    }
+
+    // Drop the entry along with the last reference to it, unless it has been
+    // replaced since. The store may already be gone during shutdown.
+    auto deleter = [key](const AppData *data) {
+        if (!appDataStoreData.isDestroyed()) {
+            auto it = appDataStoreData->entries.find(key);
+
+            if (it != appDataStoreData->entries.end() && it->isNull()) {
+                appDataStoreData->entries.erase(it);
+            }
+        }
+
+        delete data;
+    };
+
+    const Ptr data(new AppData(appDataFromUrl(url,
+        fallbackIconName.isEmpty() ? QIcon() : QIcon::fromTheme(fallbackIconName))), deleter);
+
+    store->entries.insert(key, data.toWeakRef());
+
+    return data;
+}
+
+AppDataStore::Ptr AppDataStore::unshared(const AppData &data)
+{
+    return Ptr(new AppData(data));
+}
+
+}
@@ -0,0 +1,65 @@
+/********************************************************************
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) version 3, or any
+later version accepted by the membership of KDE e.V. (or its
+successor approved by the membership of KDE e.V.), which shall
+act as a proxy defined in Section 6 of version 3 of the license.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef APPDATASTORE_P_H
+#define APPDATASTORE_P_H
+
+#include "tasktools.h"
+
+#include <QSharedPointer>
+
+namespace TaskManager
+{
+
+/**
+ * A process-wide store of the AppData resolved for launcher URLs, shared
+ * by all window and launcher tasks models.
+ *
+ * Entries are reference-counted: the store only holds weak references,
+ * and an entry lives as long as some model's per-task cache points at
+ * it. Many windows of the same application, across any number of models,
+ * thus share a single AppData and icon.
+ *
+ * The store drops its entries when the sycoca database changes, once for
+ * all its users. The models are expected to clear their per-task caches
+ * in response to the same change.
+ **/
+namespace AppDataStore
+{
+typedef QSharedPointer<const AppData> Ptr;
+
+/**
+ * Returns the shared AppData for the given URL, resolving it with
+ * appDataFromUrl() if no model holds it yet.
+ *
+ * @param url A URL to a .desktop file or executable, or a preferred:// URL.
+ * @param fallbackIconName The name of a themed icon to use when none could
+ * be read from the URL or otherwise found.
+ */
+Ptr appData(const QUrl &url, const QString &fallbackIconName = QString());
+
+/**
+ * Wraps an AppData that is specific to one task (e.g. because it carries
+ * the task's own fallback icon) in a pointer not shared through the store.
+ */
+Ptr unshared(const AppData &data);
+}
+
+}
+
+#endif
@@ -0,0 +1,116 @@
+/********************************************************************
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) version 3, or any
+later version accepted by the membership of KDE e.V. (or its
+successor approved by the membership of KDE e.V.), which shall
+act as a proxy defined in Section 6 of version 3 of the license.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef SYNTHETICWINDOWSMODEL_H
+#define SYNTHETICWINDOWSMODEL_H
+
+#include "abstracttasksmodel.h"
+
+#include <QVector>
+
+namespace TaskManager
+{
+
+/**
+ * A flat tasks model of fake window tasks, for feeding the proxy models in
+ * tests and benchmarks without a window system.
+ *
+ * Windows are identified by their app id only; they all have the same
+ * capabilities and live on the virtual desktop they were inserted with.
+ **/
+class SyntheticWindowsModel : public AbstractTasksModel
+{
+public:
+    explicit SyntheticWindowsModel(QObject *parent = nullptr) : AbstractTasksModel(parent) {}
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override
+    {
+        return parent.isValid() ? 0 : m_windows.count();
+    }
+
+    QVariant data(const QModelIndex &index, int role) const override
+    {
+        if (!index.isValid() || index.row() >= m_windows.count()) {
+            return QVariant();
+        }
+
+        const Window &window = m_windows.at(index.row());
+
+        switch (role) {
+        case Qt::DisplayRole:
+        case AbstractTasksModel::AppId:
+        case AbstractTasksModel::AppName:
+            return window.appId;
+        case AbstractTasksModel::WinIdList:
+            return QVariantList{window.winId};
+        case AbstractTasksModel::IsWindow:
+        case AbstractTasksModel::IsClosable:
+        case AbstractTasksModel::IsMinimizable:
+        case AbstractTasksModel::IsMaximizable:
+            return true;
+        case AbstractTasksModel::IsMinimized:
+            return window.minimized;
+        case AbstractTasksModel::IsDemandingAttention:
+        case AbstractTasksModel::SkipTaskbar:
+        case AbstractTasksModel::SkipPager:
+        case AbstractTasksModel::IsOnAllVirtualDesktops:
+            return false;
+        case AbstractTasksModel::VirtualDesktops:
+            return QVariantList{window.desktop};
+        default:
+            return QVariant();
+        }
+    }
+
+    void insertWindow(int row, const QString &appId, uint desktop = 1)
+    {
+        beginInsertRows(QModelIndex(), row, row);
+        m_windows.insert(row, Window{appId, ++m_lastWinId, desktop, false});
+        endInsertRows();
+    }
+
+    void removeWindow(int row)
+    {
+        beginRemoveRows(QModelIndex(), row, row);
+        m_windows.remove(row);
+        endRemoveRows();
+    }
+
+    void setMinimized(int row, bool minimized)
+    {
+        m_windows[row].minimized = minimized;
+
+        const QModelIndex &idx = index(row, 0);
+        Q_EMIT dataChanged(idx, idx, QVector<int>{AbstractTasksModel::IsMinimized});
+    }
+
+private:
+    struct Window {
+        QString appId;
+        quint32 winId;
+        uint desktop;
+        bool minimized;
+    };
+
+    QVector<Window> m_windows;
+    quint32 m_lastWinId = 0;
+};
+
+}
+
+#endif
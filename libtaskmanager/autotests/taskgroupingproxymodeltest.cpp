@@ -0,0 +1,162 @@
+/********************************************************************
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) version 3, or any
+later version accepted by the membership of KDE e.V. (or its
+successor approved by the membership of KDE e.V.), which shall
+act as a proxy defined in Section 6 of version 3 of the license.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include <QObject>
+#include <QTest>
+
+#include "abstracttasksmodel.h"
+#include "syntheticwindowsmodel.h"
+#include "taskgroupingproxymodel.h"
+
+using namespace TaskManager;
+
+class TaskGroupingProxyModelTest : public QObject
+{
+    Q_OBJECT
+
+    private Q_SLOTS:
+        void shouldGroupByAppId();
+        void shouldMapAfterRemovals();
+        void shouldKeepPersistentChildIndices();
+        void benchmarkOpenCloseGroupedWindows();
+
+    private:
+        static void verifyMapping(const TaskGroupingProxyModel &m, const SyntheticWindowsModel &source);
+};
+
+void TaskGroupingProxyModelTest::verifyMapping(const TaskGroupingProxyModel &m, const SyntheticWindowsModel &source)
+{
+    for (int i = 0; i < source.rowCount(); ++i) {
+        const QModelIndex &sourceIndex = source.index(i, 0);
+        const QModelIndex &proxyIndex = m.mapFromSource(sourceIndex);
+
+        QVERIFY(proxyIndex.isValid());
+        QCOMPARE(m.mapToSource(proxyIndex), sourceIndex);
+
+        if (proxyIndex.parent().isValid()) {
+            QCOMPARE(m.index(proxyIndex.row(), 0, proxyIndex.parent()), proxyIndex);
+        }
+    }
+}
+
+void TaskGroupingProxyModelTest::shouldGroupByAppId()
+{
+    SyntheticWindowsModel source;
+    TaskGroupingProxyModel m;
+    m.setSourceModel(&source);
+
+    source.insertWindow(0, QStringLiteral("a"));
+    source.insertWindow(1, QStringLiteral("b"));
+    source.insertWindow(2, QStringLiteral("a"));
+    source.insertWindow(0, QStringLiteral("b"));
+
+    QCOMPARE(m.rowCount(), 2);
+    QCOMPARE(m.rowCount(m.index(0, 0)), 2);
+    QCOMPARE(m.rowCount(m.index(1, 0)), 2);
+    QVERIFY(m.index(0, 0).data(AbstractTasksModel::IsGroupParent).toBool());
+
+    verifyMapping(m, source);
+}
+
+void TaskGroupingProxyModelTest::shouldMapAfterRemovals()
+{
+    SyntheticWindowsModel source;
+    TaskGroupingProxyModel m;
+    m.setSourceModel(&source);
+
+    for (int i = 0; i < 12; ++i) {
+        source.insertWindow(i, QString::number(i % 3));
+    }
+
+    QCOMPARE(m.rowCount(), 3);
+
+    source.removeWindow(0);
+    source.removeWindow(5);
+    source.removeWindow(source.rowCount() - 1);
+
+    QCOMPARE(m.rowCount(), 3);
+    verifyMapping(m, source);
+
+    // Dissolve the groups down to single windows.
+    while (source.rowCount() > 3) {
+        source.removeWindow(0);
+        verifyMapping(m, source);
+    }
+
+    QCOMPARE(m.rowCount(), 3);
+
+    for (int i = 0; i < m.rowCount(); ++i) {
+        QCOMPARE(m.rowCount(m.index(i, 0)), 0);
+    }
+}
+
+void TaskGroupingProxyModelTest::shouldKeepPersistentChildIndices()
+{
+    SyntheticWindowsModel source;
+    TaskGroupingProxyModel m;
+    m.setSourceModel(&source);
+
+    source.insertWindow(0, QStringLiteral("a"));
+    source.insertWindow(1, QStringLiteral("b"));
+    source.insertWindow(2, QStringLiteral("b"));
+    source.insertWindow(3, QStringLiteral("b"));
+
+    const QPersistentModelIndex child(m.index(2, 0, m.index(1, 0)));
+    QVERIFY(child.isValid());
+    QCOMPARE(m.mapToSource(child).row(), 3);
+
+    // Removing the row above the group moves the group, not its children.
+    source.removeWindow(0);
+
+    QVERIFY(child.isValid());
+    QCOMPARE(child.parent(), m.index(0, 0));
+    QCOMPARE(m.mapToSource(child).row(), 2);
+
+    // Removing an earlier sibling moves the child up.
+    source.removeWindow(0);
+
+    QVERIFY(child.isValid());
+    QCOMPARE(child.row(), 1);
+    QCOMPARE(m.mapToSource(child).row(), 1);
+}
+
+void TaskGroupingProxyModelTest::benchmarkOpenCloseGroupedWindows()
+{
+    const int windows = 1000;
+    const int apps = 10;
+
+    QBENCHMARK {
+        SyntheticWindowsModel source;
+        TaskGroupingProxyModel m;
+        m.setSourceModel(&source);
+
+        for (int i = 0; i < windows; ++i) {
+            source.insertWindow(i, QString::number(i % apps));
+        }
+
+        // Close from the middle, so that both the rows before and after the
+        // removed one are affected.
+        while (source.rowCount()) {
+            source.removeWindow(source.rowCount() / 2);
+        }
+    }
+}
+
+QTEST_MAIN(TaskGroupingProxyModelTest)
+
+#include "taskgroupingproxymodeltest.moc"
@@ -0,0 +1,287 @@
+/********************************************************************
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) version 3, or any
+later version accepted by the membership of KDE e.V. (or its
+successor approved by the membership of KDE e.V.), which shall
+act as a proxy defined in Section 6 of version 3 of the license.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include <QObject>
+#include <QTest>
+
+#include "flattentaskgroupsproxymodel.h"
+#include "syntheticwindowsmodel.h"
+#include "taskfilterproxymodel.h"
+#include "taskgroupingproxymodel.h"
+#include "tasksmodel.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Count every heap allocation made by the process, so the benchmarks can
+// report allocations alongside timings.
+static std::atomic<quint64> s_allocations(0);
+
+void *operator new(std::size_t size)
+{
+    ++s_allocations;
+
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+using namespace TaskManager;
+
+// Runs the given function and prints the number of heap allocations it made,
+// tagged with the current data row.
+template<typename Func>
+static void reportAllocations(const char *what, Func func)
+{
+    const quint64 before = s_allocations;
+    func();
+    const quint64 allocations = s_allocations - before;
+
+    qInfo("%s (%s): %llu allocations", what, QTest::currentDataTag(), allocations);
+}
+
+// The proxy chain TasksModel builds internally, minus the concatenation and
+// the final sort stage, on top of a synthetic source model.
+struct ProxyChain
+{
+    ProxyChain()
+    {
+        filterModel.setSourceModel(&source);
+        filterModel.setVirtualDesktop(QVariant(1u));
+        filterModel.setFilterByVirtualDesktop(true);
+        filterModel.setFilterNotMinimized(false);
+
+        groupingModel.setSourceModel(&filterModel);
+        groupingModel.setGroupMode(TasksModel::GroupApplications);
+
+        flattenModel.setSourceModel(&groupingModel);
+    }
+
+    // Spreads windows over a tenth as many apps and two virtual desktops.
+    void addWindows(int count)
+    {
+        const int apps = qMax(1, count / 10);
+
+        for (int i = 0; i < count; ++i) {
+            source.insertWindow(source.rowCount(), QStringLiteral("app%1").arg(i % apps), (i % 4) ? 1 : 2);
+        }
+    }
+
+    void removeWindows()
+    {
+        while (source.rowCount()) {
+            source.removeWindow(source.rowCount() / 2);
+        }
+    }
+
+    SyntheticWindowsModel source;
+    TaskFilterProxyModel filterModel;
+    TaskGroupingProxyModel groupingModel;
+    FlattenTaskGroupsProxyModel flattenModel;
+};
+
+class TasksProxyChainBenchmark : public QObject
+{
+    Q_OBJECT
+
+    private Q_SLOTS:
+        void initTestCase();
+
+        void benchmarkAddWindows_data();
+        void benchmarkAddWindows();
+        void benchmarkRemoveWindows_data();
+        void benchmarkRemoveWindows();
+        void benchmarkDataChanged_data();
+        void benchmarkDataChanged();
+        void benchmarkAddRemoveLaunchers_data();
+        void benchmarkAddRemoveLaunchers();
+        void benchmarkResort_data();
+        void benchmarkResort();
+
+    private:
+        static void populateSizes();
+        static QStringList launcherUrls(int count);
+};
+
+void TasksProxyChainBenchmark::initTestCase()
+{
+    qApp->setProperty("org.kde.KActivities.core.disableAutostart", true);
+}
+
+void TasksProxyChainBenchmark::populateSizes()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("10") << 10;
+    QTest::newRow("100") << 100;
+    QTest::newRow("1000") << 1000;
+}
+
+QStringList TasksProxyChainBenchmark::launcherUrls(int count)
+{
+    QStringList urls;
+    urls.reserve(count);
+
+    for (int i = 0; i < count; ++i) {
+        urls << QStringLiteral("file:///usr/share/applications/org.example.app%1.desktop").arg(count - i);
+    }
+
+    return urls;
+}
+
+void TasksProxyChainBenchmark::benchmarkAddWindows_data()
+{
+    populateSizes();
+}
+
+void TasksProxyChainBenchmark::benchmarkAddWindows()
+{
+    QFETCH(int, count);
+
+    // Structural changes can't be undone for free, so run them once on a
+    // fresh chain rather than repeatedly.
+    ProxyChain chain;
+
+    reportAllocations("add", [&chain, count]() {
+        QBENCHMARK_ONCE {
+            chain.addWindows(count);
+        }
+    });
+}
+
+void TasksProxyChainBenchmark::benchmarkRemoveWindows_data()
+{
+    populateSizes();
+}
+
+void TasksProxyChainBenchmark::benchmarkRemoveWindows()
+{
+    QFETCH(int, count);
+
+    ProxyChain chain;
+    chain.addWindows(count);
+
+    reportAllocations("remove", [&chain]() {
+        QBENCHMARK_ONCE {
+            chain.removeWindows();
+        }
+    });
+
+    QCOMPARE(chain.flattenModel.rowCount(), 0);
+}
+
+void TasksProxyChainBenchmark::benchmarkDataChanged_data()
+{
+    populateSizes();
+}
+
+void TasksProxyChainBenchmark::benchmarkDataChanged()
+{
+    QFETCH(int, count);
+
+    ProxyChain chain;
+    chain.addWindows(count);
+
+    auto toggleAll = [&chain]() {
+        for (int i = 0; i < chain.source.rowCount(); ++i) {
+            const QModelIndex &idx = chain.source.index(i, 0);
+            chain.source.setMinimized(i, !idx.data(AbstractTasksModel::IsMinimized).toBool());
+        }
+    };
+
+    reportAllocations("dataChanged", toggleAll);
+
+    QBENCHMARK {
+        toggleAll();
+    }
+}
+
+void TasksProxyChainBenchmark::benchmarkAddRemoveLaunchers_data()
+{
+    populateSizes();
+}
+
+void TasksProxyChainBenchmark::benchmarkAddRemoveLaunchers()
+{
+    // TasksModel builds its own source models; launchers are the only tasks
+    // that can be fed into it without a window system.
+    QFETCH(int, count);
+
+    const QStringList &urls = launcherUrls(count);
+
+    TasksModel m;
+    m.setSortMode(TasksModel::SortAlphabetical);
+
+    auto addRemove = [&m, &urls]() {
+        for (const QString &url : urls) {
+            m.requestAddLauncher(QUrl(url));
+        }
+
+        for (const QString &url : urls) {
+            m.requestRemoveLauncher(QUrl(url));
+        }
+    };
+
+    reportAllocations("add/remove launchers", addRemove);
+
+    QBENCHMARK {
+        addRemove();
+    }
+}
+
+void TasksProxyChainBenchmark::benchmarkResort_data()
+{
+    populateSizes();
+}
+
+void TasksProxyChainBenchmark::benchmarkResort()
+{
+    QFETCH(int, count);
+
+    TasksModel m;
+    m.setLauncherList(launcherUrls(count));
+    QCOMPARE(m.launcherCount(), count);
+
+    auto resort = [&m]() {
+        m.setSortMode(TasksModel::SortAlphabetical);
+        m.setSortMode(TasksModel::SortDisabled);
+    };
+
+    reportAllocations("resort", resort);
+
+    QBENCHMARK {
+        resort();
+    }
+}
+
+QTEST_MAIN(TasksProxyChainBenchmark)
+
+#include "tasksproxychainbenchmark.moc"
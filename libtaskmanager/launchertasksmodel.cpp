@@ -19,13 +19,14 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 *********************************************************************/
 
 #include "launchertasksmodel.h"
+#include "appdatastore_p.h"
 #include "tasktools.h"
+#include "tasktools_p.h"
 
 #include <KDesktopFile>
 #include <KNotificationJobUiDelegate>
 #include <KService>
 #include <KStartupInfo>
-#include <KSycoca>
 #include <KWindowSystem>
 
 #include <KActivities/Consumer>
@@ -76,7 +77,7 @@ public:
         }
     }
 
-    QHash<QUrl, AppData> appDataCache;
+    QHash<QUrl, AppDataStore::Ptr> appDataCache;
     QTimer sycocaChangeTimer;
 
     void init();
@@ -116,16 +117,9 @@ void LauncherTasksModel::Private::init()
         }
     );
 
-    void (KSycoca::*myDatabaseChangeSignal)(const QStringList &) = &KSycoca::databaseChanged;
-    QObject::connect(KSycoca::self(), myDatabaseChangeSignal, q,
-        [this](const QStringList &changedResources) {
-            if (changedResources.contains(QLatin1String("services"))
-                || changedResources.contains(QLatin1String("apps"))
-                || changedResources.contains(QLatin1String("xdgdata-apps"))) {
-                sycocaChangeTimer.start();
-            }
-        }
-    );
+    connectToApplicationsChanged(q, [this] {
+        sycocaChangeTimer.start();
+    });
 }
 
 AppData LauncherTasksModel::Private::appData(const QUrl &url)
@@ -133,14 +127,14 @@ AppData LauncherTasksModel::Private::appData(const QUrl &url)
     const auto &it = appDataCache.constFind(url);
 
     if (it != appDataCache.constEnd()) {
-        return *it;
+        return **it;
     }
 
-    const AppData &data = appDataFromUrl(url, QIcon::fromTheme(QLatin1String("unknown")));
+    const AppDataStore::Ptr &data = AppDataStore::appData(url, QStringLiteral("unknown"));
 
     appDataCache.insert(url, data);
 
-    return data;
+    return *data;
 }
 
 bool LauncherTasksModel::Private::requestAddLauncherToActivities(const QUrl &_url, const QStringList &_activities)
@@ -24,9 +24,231 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <QSet>
 
+#include <algorithm>
+
 namespace TaskManager
 {
 
+// Maps the top-level rows of the proxy (and for groups, their children) to
+// source rows.
+//
+// The source rows of all top-level items are kept back to back in a single
+// vector, delimited by a vector of offsets, so items don't need a heap
+// allocation of their own. Every top-level item is assigned an id that stays
+// stable while rows come and go and is used as the internal id of child
+// indices. Since top-level items are only ever appended, ids are ascending
+// in row order and can be looked up by binary search. A reverse index keyed
+// by source row allows mapping from the source without scanning the map.
+class Q_DECL_HIDDEN RowMap
+{
+public:
+    int count() const { return m_ids.count(); }
+    int groupSize(int row) const { return m_offsets.at(row + 1) - m_offsets.at(row); }
+    int sourceRow(int row, int child = 0) const { return m_sourceRows.at(m_offsets.at(row) + child); }
+    QVector<int> sourceRows(int row) const { return m_sourceRows.mid(m_offsets.at(row), groupSize(row)); }
+    quintptr id(int row) const { return m_ids.at(row); }
+
+    int rowForId(quintptr id) const;
+    bool locate(int sourceRow, int *row, int *child) const;
+
+    void clear(int sourceRowCount = 0);
+    void appendRow(int sourceRow);
+    void removeRow(int row);
+    void appendChild(int row, int sourceRow);
+    void removeChild(int row, int child);
+    void truncate(int row, int size);
+
+    void insertSourceRows(int first, int count);
+    void removeSourceRows(int first, int count);
+
+private:
+    void setPosition(int sourceRow, quintptr id, int child);
+    void clearPosition(int sourceRow, quintptr id);
+
+    QVector<int> m_sourceRows;
+    QVector<int> m_offsets = QVector<int>{0};
+    QVector<quintptr> m_ids;
+    quintptr m_nextId = 1;
+
+    QVector<quintptr> m_idForSourceRow;
+    QVector<int> m_childForSourceRow;
+};
+
+int RowMap::rowForId(quintptr id) const
+{
+    const auto it = std::lower_bound(m_ids.constBegin(), m_ids.constEnd(), id);
+
+    if (it != m_ids.constEnd() && *it == id) {
+        return (it - m_ids.constBegin());
+    }
+
+    return -1;
+}
+
+bool RowMap::locate(int sourceRow, int *row, int *child) const
+{
+    if (sourceRow < 0 || sourceRow >= m_idForSourceRow.count()) {
+        return false;
+    }
+
+    const quintptr id = m_idForSourceRow.at(sourceRow);
+
+    if (!id) {
+        return false;
+    }
+
+    *row = rowForId(id);
+    *child = m_childForSourceRow.at(sourceRow);
+
+    return (*row != -1);
+}
+
+void RowMap::clear(int sourceRowCount)
+{
+    m_sourceRows.clear();
+    m_sourceRows.reserve(sourceRowCount);
+    m_offsets.clear();
+    m_offsets.reserve(sourceRowCount + 1);
+    m_offsets.append(0);
+    m_ids.clear();
+    m_ids.reserve(sourceRowCount);
+
+    m_idForSourceRow.fill(0, sourceRowCount);
+    m_childForSourceRow.fill(-1, sourceRowCount);
+}
+
+void RowMap::appendRow(int sourceRow)
+{
+    const quintptr id = m_nextId++;
+
+    m_sourceRows.append(sourceRow);
+    m_offsets.append(m_sourceRows.count());
+    m_ids.append(id);
+
+    setPosition(sourceRow, id, 0);
+}
+
+void RowMap::removeRow(int row)
+{
+    const int first = m_offsets.at(row);
+    const int size = groupSize(row);
+    const quintptr id = m_ids.at(row);
+
+    for (int i = first; i < first + size; ++i) {
+        clearPosition(m_sourceRows.at(i), id);
+    }
+
+    m_sourceRows.remove(first, size);
+    m_offsets.remove(row + 1);
+
+    for (int i = row + 1; i < m_offsets.count(); ++i) {
+        m_offsets[i] -= size;
+    }
+
+    m_ids.remove(row);
+}
+
+void RowMap::appendChild(int row, int sourceRow)
+{
+    m_sourceRows.insert(m_offsets.at(row + 1), sourceRow);
+
+    for (int i = row + 1; i < m_offsets.count(); ++i) {
+        ++m_offsets[i];
+    }
+
+    setPosition(sourceRow, m_ids.at(row), groupSize(row) - 1);
+}
+
+void RowMap::removeChild(int row, int child)
+{
+    const int first = m_offsets.at(row);
+
+    clearPosition(m_sourceRows.at(first + child), m_ids.at(row));
+    m_sourceRows.remove(first + child);
+
+    for (int i = row + 1; i < m_offsets.count(); ++i) {
+        --m_offsets[i];
+    }
+
+    // Later siblings move up by one.
+    for (int i = first + child; i < m_offsets.at(row + 1); ++i) {
+        --m_childForSourceRow[m_sourceRows.at(i)];
+    }
+}
+
+void RowMap::truncate(int row, int size)
+{
+    const int first = m_offsets.at(row);
+    const int excess = groupSize(row) - size;
+
+    if (excess <= 0) {
+        return;
+    }
+
+    for (int i = first + size; i < first + size + excess; ++i) {
+        clearPosition(m_sourceRows.at(i), m_ids.at(row));
+    }
+
+    m_sourceRows.remove(first + size, excess);
+
+    for (int i = row + 1; i < m_offsets.count(); ++i) {
+        m_offsets[i] -= excess;
+    }
+}
+
+void RowMap::insertSourceRows(int first, int count)
+{
+    for (int &sourceRow : m_sourceRows) {
+        if (sourceRow >= first) {
+            sourceRow += count;
+        }
+    }
+
+    if (first > m_idForSourceRow.count()) {
+        m_idForSourceRow.resize(first);
+        m_childForSourceRow.resize(first);
+    }
+
+    m_idForSourceRow.insert(first, count, 0);
+    m_childForSourceRow.insert(first, count, -1);
+}
+
+void RowMap::removeSourceRows(int first, int count)
+{
+    for (int &sourceRow : m_sourceRows) {
+        if (sourceRow >= first + count) {
+            sourceRow -= count;
+        }
+    }
+
+    if (first < m_idForSourceRow.count()) {
+        count = qMin(count, m_idForSourceRow.count() - first);
+        m_idForSourceRow.remove(first, count);
+        m_childForSourceRow.remove(first, count);
+    }
+}
+
+void RowMap::setPosition(int sourceRow, quintptr id, int child)
+{
+    if (sourceRow >= m_idForSourceRow.count()) {
+        m_idForSourceRow.resize(sourceRow + 1);
+        m_childForSourceRow.resize(sourceRow + 1);
+    }
+
+    m_idForSourceRow[sourceRow] = id;
+    m_childForSourceRow[sourceRow] = child;
+}
+
+void RowMap::clearPosition(int sourceRow, quintptr id)
+{
+    // The source row may have moved on to another item already, e.g. when it
+    // was added to a group before its own top-level item is removed.
+    if (sourceRow < m_idForSourceRow.count() && m_idForSourceRow.at(sourceRow) == id) {
+        m_idForSourceRow[sourceRow] = 0;
+        m_childForSourceRow[sourceRow] = -1;
+    }
+}
+
 class Q_DECL_HIDDEN TaskGroupingProxyModel::Private
 {
 public:
@@ -39,7 +261,7 @@ public:
     bool groupDemandingAttention = false;
     int windowTasksThreshold = -1;
 
-    QVector<QVector<int> *> rowMap;
+    RowMap rowMap;
 
     QSet<QString> blacklistedAppIds;
     QSet<QString> blacklistedLauncherUrls;
@@ -56,7 +278,6 @@ public:
     void sourceModelReset();
     void sourceDataChanged(QModelIndex topLeft, QModelIndex bottomRight,
         const QVector<int> &roles = QVector<int>());
-    void adjustMap(int anchor, int delta);
 
     void rebuildMap();
     bool shouldGroupTasks();
@@ -77,7 +298,6 @@ TaskGroupingProxyModel::Private::Private(TaskGroupingProxyModel *q)
 
 TaskGroupingProxyModel::Private::~Private()
 {
-    qDeleteAll(rowMap);
 }
 
 bool TaskGroupingProxyModel::Private::isGroup(int row)
@@ -86,7 +306,7 @@ bool TaskGroupingProxyModel::Private::isGroup(int row)
         return false;
     }
 
-    return (rowMap.at(row)->count() > 1);
+    return (rowMap.groupSize(row) > 1);
 }
 
 bool TaskGroupingProxyModel::Private::any(const QModelIndex &parent, int role)
@@ -129,14 +349,14 @@ void TaskGroupingProxyModel::Private::sourceRowsInserted(const QModelIndex &pare
         return;
     }
 
-    adjustMap(start, (end - start) + 1);
+    rowMap.insertSourceRows(start, (end - start) + 1);
 
     bool shouldGroup = shouldGroupTasks(); // Can be slightly expensive; cache return value.
 
     for (int i = start; i <= end; ++i) {
         if (!shouldGroup || !tryToGroup(q->sourceModel()->index(i, 0))) {
             q->beginInsertRows(QModelIndex(), rowMap.count(), rowMap.count());
-            rowMap.append(new QVector<int>{i});
+            rowMap.appendRow(i);
             q->endInsertRows();
         }
     }
@@ -152,39 +372,39 @@ void TaskGroupingProxyModel::Private::sourceRowsAboutToBeRemoved(const QModelInd
     }
 
     for (int i = first; i <= last; ++i) {
-        for (int j = 0; j < rowMap.count(); ++j) {
-            const QVector<int> *sourceRows = rowMap.at(j);
-            const int mapIndex = sourceRows->indexOf(i);
-
-            if (mapIndex != -1) {
-                // Remove top-level item.
-                if (sourceRows->count() == 1) {
-                    q->beginRemoveRows(QModelIndex(), j, j);
-                    delete rowMap.takeAt(j);
-                    q->endRemoveRows();
-                // Dissolve group.
-                } else if (sourceRows->count() == 2) {
-                    const QModelIndex parent = q->index(j, 0);
-                    q->beginRemoveRows(parent, 0, 1);
-                    rowMap[j]->remove(mapIndex);
-                    q->endRemoveRows();
-
-                    // We're no longer a group parent.
-                    Q_EMIT q->dataChanged(parent, parent);
-                // Remove group member.
-                } else {
-                    const QModelIndex parent = q->index(j, 0);
-                    q->beginRemoveRows(parent, mapIndex, mapIndex);
-                    rowMap[j]->remove(mapIndex);
-                    q->endRemoveRows();
-
-                    // Various roles of the parent evaluate child data, and the
-                    // child list has changed.
-                    Q_EMIT q->dataChanged(parent, parent);
-                }
+        int j = -1;
+        int mapIndex = -1;
 
-                break;
-            }
+        if (!rowMap.locate(i, &j, &mapIndex)) {
+            continue;
+        }
+
+        const int groupSize = rowMap.groupSize(j);
+
+        // Remove top-level item.
+        if (groupSize == 1) {
+            q->beginRemoveRows(QModelIndex(), j, j);
+            rowMap.removeRow(j);
+            q->endRemoveRows();
+        // Dissolve group.
+        } else if (groupSize == 2) {
+            const QModelIndex parent = q->index(j, 0);
+            q->beginRemoveRows(parent, 0, 1);
+            rowMap.removeChild(j, mapIndex);
+            q->endRemoveRows();
+
+            // We're no longer a group parent.
+            Q_EMIT q->dataChanged(parent, parent);
+        // Remove group member.
+        } else {
+            const QModelIndex parent = q->index(j, 0);
+            q->beginRemoveRows(parent, mapIndex, mapIndex);
+            rowMap.removeChild(j, mapIndex);
+            q->endRemoveRows();
+
+            // Various roles of the parent evaluate child data, and the
+            // child list has changed.
+            Q_EMIT q->dataChanged(parent, parent);
         }
     }
 }
@@ -196,7 +416,7 @@ void TaskGroupingProxyModel::Private::sourceRowsRemoved(const QModelIndex &paren
         return;
     }
 
-    adjustMap(start + 1, -((end - start) + 1));
+    rowMap.removeSourceRows(start, (end - start) + 1);
 
     checkGrouping();
 }
@@ -242,7 +462,7 @@ void TaskGroupingProxyModel::Private::sourceDataChanged(QModelIndex topLeft, QMo
 
             if (shouldGroupTasks() && tryToGroup(sourceIndex)) {
                 q->beginRemoveRows(QModelIndex(), proxyIndex.row(), proxyIndex.row());
-                delete rowMap.takeAt(proxyIndex.row());
+                rowMap.removeRow(proxyIndex.row());
                 q->endRemoveRows();
             } else {
                 Q_EMIT q->dataChanged(proxyIndex, proxyIndex, roles);
@@ -253,33 +473,14 @@ void TaskGroupingProxyModel::Private::sourceDataChanged(QModelIndex topLeft, QMo
     }
 }
 
-void TaskGroupingProxyModel::Private::adjustMap(int anchor, int delta)
-{
-    for (int i = 0; i < rowMap.count(); ++i) {
-        QVector<int> *sourceRows = rowMap.at(i);
-        QMutableVectorIterator<int> it(*sourceRows);
-
-        while (it.hasNext()) {
-            it.next();
-
-            if (it.value() >= anchor) {
-                it.setValue(it.value() + delta);
-            }
-        }
-    }
-}
-
 void TaskGroupingProxyModel::Private::rebuildMap()
 {
-    qDeleteAll(rowMap);
-    rowMap.clear();
-
     const int rows = q->sourceModel()->rowCount();
 
-    rowMap.reserve(rows);
+    rowMap.clear(rows);
 
     for (int i = 0; i < rows; ++i) {
-        rowMap.append(new QVector<int>{i});
+        rowMap.appendRow(i);
     }
 
     checkGrouping(true /* silent */);
@@ -322,9 +523,9 @@ void TaskGroupingProxyModel::Private::checkGrouping(bool silent)
                 continue;
             }
 
-            if (tryToGroup(q->sourceModel()->index(rowMap.at(i)->constFirst(), 0), silent)) {
+            if (tryToGroup(q->sourceModel()->index(rowMap.sourceRow(i), 0), silent)) {
                 q->beginRemoveRows(QModelIndex(), i, i);
-                delete rowMap.takeAt(i); // Safe since we're iterating backwards.
+                rowMap.removeRow(i); // Safe since we're iterating backwards.
                 q->endRemoveRows();
             }
         }
@@ -382,7 +583,7 @@ bool TaskGroupingProxyModel::Private::tryToGroup(const QModelIndex &sourceIndex,
     // Meat of the matter: Try to add this source row to a sub-list with source rows
     // associated with the same application.
     for (int i = 0; i < rowMap.count(); ++i) {
-        const QModelIndex &groupRep = q->sourceModel()->index(rowMap.at(i)->constFirst(), 0);
+        const QModelIndex &groupRep = q->sourceModel()->index(rowMap.sourceRow(i), 0);
 
         // Don't match a row with itself.
         if (sourceIndex == groupRep) {
@@ -398,7 +599,7 @@ bool TaskGroupingProxyModel::Private::tryToGroup(const QModelIndex &sourceIndex,
             const QModelIndex parent = q->index(i, 0);
 
             if (!silent) {
-                const int newIndex = rowMap.at(i)->count();
+                const int newIndex = rowMap.groupSize(i);
 
                 if (newIndex == 1) {
                     q->beginInsertRows(parent, 0, 1);
@@ -407,7 +608,7 @@ bool TaskGroupingProxyModel::Private::tryToGroup(const QModelIndex &sourceIndex,
                 }
             }
 
-            rowMap[i]->append(sourceIndex.row());
+            rowMap.appendChild(i, sourceIndex.row());
 
             if (!silent) {
                 q->endInsertRows();
@@ -434,7 +635,7 @@ void TaskGroupingProxyModel::Private::formGroupFor(const QModelIndex &index)
     const QModelIndex &sourceTarget = q->mapToSource(index);
 
     for (int i = (rowMap.count() - 1); i >= 0; --i) {
-        const QModelIndex &sourceIndex = q->sourceModel()->index(rowMap.at(i)->constFirst(), 0);
+        const QModelIndex &sourceIndex = q->sourceModel()->index(rowMap.sourceRow(i), 0);
 
         if (!appsMatch(sourceTarget, sourceIndex)) {
             continue;
@@ -442,7 +643,7 @@ void TaskGroupingProxyModel::Private::formGroupFor(const QModelIndex &index)
 
         if (tryToGroup(sourceIndex)) {
             q->beginRemoveRows(QModelIndex(), i, i);
-            delete rowMap.takeAt(i); // Safe since we're iterating backwards.
+            rowMap.removeRow(i); // Safe since we're iterating backwards.
             q->endRemoveRows();
         }
     }
@@ -457,7 +658,7 @@ void TaskGroupingProxyModel::Private::breakGroupFor(const QModelIndex &index, bo
     }
 
     // The first child will move up to the top level.
-    QVector<int> extraChildren = rowMap.at(row)->mid(1);
+    const QVector<int> extraChildren = rowMap.sourceRows(row).mid(1);
 
     // NOTE: We're going to do remove+insert transactions instead of a
     // single reparenting move transaction to save on complexity in the
@@ -468,7 +669,7 @@ void TaskGroupingProxyModel::Private::breakGroupFor(const QModelIndex &index, bo
         q->beginRemoveRows(index, 0, extraChildren.count());
     }
 
-    rowMap[row]->resize(1);
+    rowMap.truncate(row, 1);
 
     if (!silent) {
         q->endRemoveRows();
@@ -481,7 +682,7 @@ void TaskGroupingProxyModel::Private::breakGroupFor(const QModelIndex &index, bo
     }
 
     for (int i = 0; i < extraChildren.count(); ++i) {
-        rowMap.append(new QVector<int>{extraChildren.at(i)});
+        rowMap.appendRow(extraChildren.at(i));
     }
 
     if (!silent) {
@@ -504,12 +705,12 @@ QModelIndex TaskGroupingProxyModel::index(int row, int column, const QModelIndex
         return QModelIndex();
     }
 
-    if (parent.isValid() && row < d->rowMap.at(parent.row())->count()) {
-        return createIndex(row, column, d->rowMap.at(parent.row()));
+    if (parent.isValid() && row < d->rowMap.groupSize(parent.row())) {
+        return createIndex(row, column, d->rowMap.id(parent.row()));
     }
 
     if (row < d->rowMap.count()) {
-        return createIndex(row, column, nullptr);
+        return createIndex(row, column, quintptr(0));
     }
 
     return QModelIndex();
@@ -517,16 +718,16 @@ QModelIndex TaskGroupingProxyModel::index(int row, int column, const QModelIndex
 
 QModelIndex TaskGroupingProxyModel::parent(const QModelIndex &child) const
 {
-    if (child.internalPointer() == nullptr) {
+    if (child.internalId() == 0) {
         return QModelIndex();
     } else {
-        const int parentRow = d->rowMap.indexOf(static_cast<QVector<int> *>(child.internalPointer()));
+        const int parentRow = d->rowMap.rowForId(child.internalId());
 
         if (parentRow != -1) {
             return index(parentRow, 0);
         }
 
-        // If we were asked to find the parent for an internalPointer we can't
+        // If we were asked to find the parent for an internalId we can't
         // locate, we have corrupted data: This should not happen.
         Q_ASSERT(parentRow != -1);
     }
@@ -540,28 +741,25 @@ QModelIndex TaskGroupingProxyModel::mapFromSource(const QModelIndex &sourceIndex
         return QModelIndex();
     }
 
-    for (int i = 0; i < d->rowMap.count(); ++i) {
-        const QVector<int> *sourceRows = d->rowMap.at(i);
-        const int childIndex = sourceRows->indexOf(sourceIndex.row());
-        const QModelIndex parent = index(i, 0);
-
-        if (childIndex == 0) {
-            // If the sub-list we found the source row in is larger than 1 (i.e. part
-            // of a group, map to the logical child item instead of the parent item
-            // the source row also stands in for. The parent is therefore unreachable
-            // from mapToSource().
-            if (d->isGroup(i)) {
-                return index(0, 0, parent);
-            // Otherwise map to the top-level item.
-            } else {
-                return parent;
-            }
-        } else if (childIndex != -1) {
-            return index(childIndex, 0, parent);
-        }
+    int row = -1;
+    int childIndex = -1;
+
+    if (!d->rowMap.locate(sourceIndex.row(), &row, &childIndex)) {
+        return QModelIndex();
     }
 
-    return QModelIndex();
+    const QModelIndex parent = index(row, 0);
+
+    // If the sub-list we found the source row in is larger than 1 (i.e. part
+    // of a group, map to the logical child item instead of the parent item
+    // the source row also stands in for. The parent is therefore unreachable
+    // from mapToSource().
+    if (d->isGroup(row)) {
+        return index(childIndex, 0, parent);
+    }
+
+    // Otherwise map to the top-level item.
+    return parent;
 }
 
 QModelIndex TaskGroupingProxyModel::mapToSource(const QModelIndex &proxyIndex) const
@@ -577,7 +775,7 @@ QModelIndex TaskGroupingProxyModel::mapToSource(const QModelIndex &proxyIndex) c
             return QModelIndex();
         }
 
-        return sourceModel()->index(d->rowMap.at(parent.row())->at(proxyIndex.row()), 0);
+        return sourceModel()->index(d->rowMap.sourceRow(parent.row(), proxyIndex.row()), 0);
     } else {
         // Group parents items therefore equate to the first child item; the source
         // row logically appears twice in the proxy.
@@ -585,7 +783,7 @@ QModelIndex TaskGroupingProxyModel::mapToSource(const QModelIndex &proxyIndex) c
         // filter out rows, too) and opts to map to the child item, as the group parent
         // has its Qt::DisplayRole mangled by data(), and it's more useful for trans-
         // lating dataChanged() from the source model.
-        return sourceModel()->index(d->rowMap.at(proxyIndex.row())->at(0), 0);
+        return sourceModel()->index(d->rowMap.sourceRow(proxyIndex.row()), 0);
     }
 
     return QModelIndex();
@@ -608,7 +806,7 @@ int TaskGroupingProxyModel::rowCount(const QModelIndex &parent) const
             return 0;
         }
 
-        const uint rowCount = d->rowMap.at(parent.row())->count();
+        const uint rowCount = d->rowMap.groupSize(parent.row());
 
         // If this sub-list in the map only has one entry, it's a plain item, not
         // parent to a group.
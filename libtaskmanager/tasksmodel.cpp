@@ -33,15 +33,24 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "launchertasksmodel_p.h"
 
+#include <QCollator>
 #include <QGuiApplication>
 #include <QTimer>
 #include <QUrl>
 
+#include <algorithm>
+#include <limits>
 #include <numeric>
 
 namespace TaskManager
 {
 
+static QCollatorSortKey emptySortKey()
+{
+    static const QCollatorSortKey key = QCollator().sortKey(QString());
+    return key;
+}
+
 class Q_DECL_HIDDEN TasksModel::Private
 {
 public:
@@ -84,6 +93,35 @@ public:
     bool usedByQml = false;
     bool componentComplete = false;
 
+    // Precomputed per-row inputs to lessThan(), for top-level rows of
+    // our source model. Entries are filled in lazily and refreshed for
+    // rows named in dataChanged() with one of the sortKeyRoles.
+    struct SortKey {
+        bool valid = false;
+        bool isLauncher = false;
+        int launcherPosition = -1;
+        bool isOnAllVirtualDesktops = false;
+        int virtualDesktopPosition = std::numeric_limits<int>::min();
+        int activityScore = 0;
+        QCollatorSortKey appNameKey = emptySortKey();
+
+        bool sortsLike(const SortKey &other) const
+        {
+            return isLauncher == other.isLauncher
+                && launcherPosition == other.launcherPosition
+                && isOnAllVirtualDesktops == other.isOnAllVirtualDesktops
+                && virtualDesktopPosition == other.virtualDesktopPosition
+                && activityScore == other.activityScore
+                && appNameKey.compare(other.appNameKey) == 0;
+        }
+    };
+
+    QCollator collator;
+    QAbstractItemModel *sortKeysModel = nullptr;
+    QVector<QMetaObject::Connection> sortKeysModelConnections;
+    mutable QVector<SortKey> sortKeys;
+    bool resortChangedRowsPending = false;
+
     void initModels();
     void initLauncherTasksModel();
     void updateAnyTaskDemandsAttention();
@@ -93,6 +131,13 @@ public:
     QModelIndex preFilterIndex(const QModelIndex &sourceIndex) const;
     void updateActivityTaskCounts();
     void forceResort();
+    void setSortKeysModel(QAbstractItemModel *model);
+    void invalidateSortKeys();
+    void scheduleResortChangedRows();
+    void resortChangedRows();
+    void resortIfMisplaced(const QVector<int> &rows);
+    const SortKey &sortKey(const QModelIndex &index, SortKey &scratch, bool launchersOnly) const;
+    void fillSortKey(const QModelIndex &index, SortKey &key, bool launchersOnly) const;
     bool lessThan(const QModelIndex &left, const QModelIndex &right,
         bool sortOnlyLaunchers = false) const;
 
@@ -171,6 +216,7 @@ void TasksModel::Private::initModels()
         [this]() {
             if (sortMode == SortActivity) {
                 updateActivityTaskCounts();
+                scheduleResortChangedRows();
             }
         }
     );
@@ -179,7 +225,7 @@ void TasksModel::Private::initModels()
         [this]() {
             if (sortMode == SortActivity) {
                 updateActivityTaskCounts();
-                forceResort();
+                scheduleResortChangedRows();
             }
         }
     );
@@ -191,6 +237,7 @@ void TasksModel::Private::initModels()
 
             if (sortMode == SortActivity && roles.contains(AbstractTasksModel::Activities)) {
                 updateActivityTaskCounts();
+                scheduleResortChangedRows();
             }
 
             if (roles.contains(AbstractTasksModel::IsActive)) {
@@ -520,6 +567,8 @@ void TasksModel::Private::initLauncherTasksModel()
         q, &TasksModel::launcherListChanged);
     QObject::connect(launcherTasksModel, &LauncherTasksModel::launcherListChanged,
         q, &TasksModel::updateLauncherCount);
+    QObject::connect(launcherTasksModel, &LauncherTasksModel::launcherListChanged,
+        q, [this]() { scheduleResortChangedRows(); });
 
     // TODO: On the assumptions that adding/removing launchers is a rare event and
     // the HasLaunchers data role is rarely used, this refreshes it for all rows in
@@ -735,6 +784,7 @@ void TasksModel::Private::updateGroupInline()
         flattenGroupsProxyModel->setSourceModel(groupingProxyModel);
 
         abstractTasksSourceModel = flattenGroupsProxyModel;
+        setSortKeysModel(flattenGroupsProxyModel);
         q->setSourceModel(flattenGroupsProxyModel);
 
         if (sortMode == SortManual) {
@@ -749,6 +799,7 @@ void TasksModel::Private::updateGroupInline()
         groupingProxyModel->setWindowTasksThreshold(groupingWindowTasksThreshold);
 
         abstractTasksSourceModel = groupingProxyModel;
+        setSortKeysModel(groupingProxyModel);
         q->setSourceModel(groupingProxyModel);
 
         delete flattenGroupsProxyModel;
@@ -822,46 +873,324 @@ void TasksModel::Private::updateActivityTaskCounts()
 
 void TasksModel::Private::forceResort()
 {
+    // Whatever prompted the resort may have changed the inputs to lessThan().
+    invalidateSortKeys();
+
     // HACK: This causes QSortFilterProxyModel to run all rows through
     // our lessThan() implementation again.
     q->setDynamicSortFilter(false);
     q->setDynamicSortFilter(true);
 }
 
+void TasksModel::Private::setSortKeysModel(QAbstractItemModel *model)
+{
+    // NOTE: This needs to be called before QSortFilterProxyModel::setSourceModel(),
+    // so our slots run ahead of the ones QSortFilterProxyModel connects to the
+    // source model and the sort keys are up to date by the time it resorts.
+
+    for (const QMetaObject::Connection &connection : qAsConst(sortKeysModelConnections)) {
+        QObject::disconnect(connection);
+    }
+
+    sortKeysModelConnections.clear();
+    sortKeys.clear();
+    sortKeysModel = model;
+
+    if (!model) {
+        return;
+    }
+
+    sortKeysModelConnections << QObject::connect(model, &QAbstractItemModel::rowsInserted, q,
+        [this](const QModelIndex &parent, int first, int last) {
+            if (parent.isValid() || first > sortKeys.count()) {
+                return;
+            }
+
+            sortKeys.insert(first, (last - first) + 1, SortKey());
+        }
+    );
+
+    sortKeysModelConnections << QObject::connect(model, &QAbstractItemModel::rowsRemoved, q,
+        [this](const QModelIndex &parent, int first, int last) {
+            if (parent.isValid() || first >= sortKeys.count()) {
+                return;
+            }
+
+            sortKeys.remove(first, qMin(last, sortKeys.count() - 1) - first + 1);
+        }
+    );
+
+    sortKeysModelConnections << QObject::connect(model, &QAbstractItemModel::dataChanged, q,
+        [this](const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles) {
+            static const QVector<int> sortKeyRoles{
+                AbstractTasksModel::IsLauncher,
+                AbstractTasksModel::LauncherUrlWithoutIcon,
+                AbstractTasksModel::IsOnAllVirtualDesktops,
+                AbstractTasksModel::VirtualDesktops,
+                AbstractTasksModel::Activities,
+                AbstractTasksModel::AppName,
+                Qt::DisplayRole
+            };
+
+            if (topLeft.parent().isValid()) {
+                return;
+            }
+
+            if (!roles.isEmpty()
+                && std::none_of(roles.constBegin(), roles.constEnd(),
+                    [](int role) { return sortKeyRoles.contains(role); })) {
+                return;
+            }
+
+            const int last = qMin(bottomRight.row(), sortKeys.count() - 1);
+
+            // QSortFilterProxyModel repositions rows on changes to the sort role
+            // by itself, it just needs the keys to be current by then.
+            if (roles.isEmpty() || roles.contains(q->sortRole())
+                || sortMode == SortManual || !q->dynamicSortFilter()) {
+                for (int i = topLeft.row(); i <= last; ++i) {
+                    sortKeys[i].valid = false;
+                }
+
+                return;
+            }
+
+            // But our sort order depends on more roles than that. Only rows whose
+            // key actually changed may need to move, e.g. not on a mere title change.
+            QVector<int> changed;
+
+            for (int i = topLeft.row(); i <= last; ++i) {
+                SortKey key;
+                fillSortKey(sortKeysModel->index(i, 0), key, false);
+
+                if (!sortKeys.at(i).valid || !sortKeys.at(i).sortsLike(key)) {
+                    changed.append(i);
+                }
+
+                sortKeys[i] = key;
+            }
+
+            if (!changed.isEmpty()) {
+                resortIfMisplaced(changed);
+            }
+        }
+    );
+
+    sortKeysModelConnections << QObject::connect(model, &QAbstractItemModel::rowsMoved, q,
+        [this]() { invalidateSortKeys(); });
+    sortKeysModelConnections << QObject::connect(model, &QAbstractItemModel::layoutChanged, q,
+        [this]() { invalidateSortKeys(); });
+    sortKeysModelConnections << QObject::connect(model, &QAbstractItemModel::modelReset, q,
+        [this]() { invalidateSortKeys(); });
+}
+
+void TasksModel::Private::invalidateSortKeys()
+{
+    sortKeys.clear();
+}
+
+void TasksModel::Private::scheduleResortChangedRows()
+{
+    // Coalesces bursts of changes (e.g. many windows closing at once) and
+    // leaves the proxy chain to settle before we look at it.
+    if (resortChangedRowsPending) {
+        return;
+    }
+
+    resortChangedRowsPending = true;
+
+    QTimer::singleShot(0, q, [this]() {
+        resortChangedRowsPending = false;
+        resortChangedRows();
+    });
+}
+
+void TasksModel::Private::resortChangedRows()
+{
+    // An alternative to forceResort() for changes to global state the sort
+    // keys depend on (launcher list, activity task counts, desktop positions):
+    // recompute the keys and only resort if a row whose key changed is now
+    // out of place.
+
+    // The sort map is not part of the sort keys; they'd be no guide.
+    if (!sortKeysModel || sortMode == SortManual) {
+        invalidateSortKeys();
+        return;
+    }
+
+    const QVector<SortKey> oldKeys = sortKeys;
+    const int count = sortKeysModel->rowCount();
+    QVector<int> changed;
+
+    sortKeys.clear();
+    sortKeys.resize(count);
+
+    for (int i = 0; i < count; ++i) {
+        SortKey &key = sortKeys[i];
+        fillSortKey(sortKeysModel->index(i, 0), key, false);
+
+        if (i >= oldKeys.count() || !oldKeys.at(i).valid || !oldKeys.at(i).sortsLike(key)) {
+            changed.append(i);
+        }
+    }
+
+    if (!changed.isEmpty()) {
+        resortIfMisplaced(changed);
+    }
+}
+
+void TasksModel::Private::resortIfMisplaced(const QVector<int> &rows)
+{
+    // QSortFilterProxyModel offers no way to reposition a single row in its
+    // mapping, so a row that has to move still takes a forceResort(). But the
+    // rows are sorted going in and only those in @p rows changed their keys:
+    // if each of them still sorts between its neighbors, all rows do, and a
+    // resort would not move anything.
+    const int count = q->rowCount();
+
+    for (const int row : rows) {
+        const QModelIndex &sourceIndex = sortKeysModel->index(row, 0);
+        const QModelIndex &proxyIndex = q->mapFromSource(sourceIndex);
+
+        if (!proxyIndex.isValid()) {
+            continue;
+        }
+
+        const int proxyRow = proxyIndex.row();
+
+        if ((proxyRow > 0
+                && lessThan(sourceIndex, q->mapToSource(q->index(proxyRow - 1, 0))))
+            || (proxyRow < count - 1
+                && lessThan(q->mapToSource(q->index(proxyRow + 1, 0)), sourceIndex))) {
+            forceResort();
+            return;
+        }
+    }
+}
+
+const TasksModel::Private::SortKey &TasksModel::Private::sortKey(const QModelIndex &index,
+    SortKey &scratch, bool launchersOnly) const
+{
+    // Only top-level rows of our source model are cached; anything else (group
+    // members, the concatProxyModel rows used by updateManualSortMap()) is
+    // computed on the fly.
+    if (index.model() != sortKeysModel || index.parent().isValid()
+        || index.row() >= sortKeys.count()) {
+        fillSortKey(index, scratch, launchersOnly);
+        return scratch;
+    }
+
+    SortKey &key = sortKeys[index.row()];
+
+    if (!key.valid) {
+        fillSortKey(index, key, false);
+    }
+
+    return key;
+}
+
+void TasksModel::Private::fillSortKey(const QModelIndex &index, SortKey &key, bool launchersOnly) const
+{
+    key = SortKey();
+    key.valid = true;
+    key.isLauncher = index.data(AbstractTasksModel::IsLauncher).toBool();
+
+    if (separateLaunchers && launchInPlace) {
+        key.launcherPosition = q->launcherPosition(index.data(AbstractTasksModel::LauncherUrlWithoutIcon).toUrl());
+    }
+
+    if (launchersOnly || sortMode == SortDisabled) {
+        return;
+    }
+
+    if (sortMode == SortVirtualDesktop && virtualDesktopInfo) {
+        key.isOnAllVirtualDesktops = index.data(AbstractTasksModel::IsOnAllVirtualDesktops).toBool();
+
+        // The lowest position among the desktops the task is on, or the minimum int
+        // if it is on none, sorting those first.
+        if (!key.isOnAllVirtualDesktops) {
+            const QVariantList &desktops = index.data(AbstractTasksModel::VirtualDesktops).toList();
+            int lowestDesktopPos = virtualDesktopInfo->numberOfDesktops();
+            bool found = false;
+
+            for (const QVariant &desktop : desktops) {
+                const int desktopPos = virtualDesktopInfo->position(desktop);
+
+                if (desktopPos <= lowestDesktopPos) {
+                    lowestDesktopPos = desktopPos;
+                    found = true;
+                }
+            }
+
+            if (found) {
+                key.virtualDesktopPosition = lowestDesktopPos;
+            }
+        }
+    }
+
+    if (sortMode == SortVirtualDesktop || sortMode == SortActivity) {
+        // updateActivityTaskCounts() counts the number of window tasks on each
+        // activity. The score is the cumulative task count for each activity the
+        // task is assigned to, or the total count if it's on all activities.
+        const QStringList &activities = index.data(AbstractTasksModel::Activities).toStringList();
+        key.activityScore = -1;
+
+        for (const QString &activity : activities) {
+            key.activityScore += activityTaskCounts.value(activity);
+        }
+
+        if (key.activityScore == -1) {
+            key.activityScore = std::accumulate(activityTaskCounts.constBegin(), activityTaskCounts.constEnd(), 0);
+        }
+    }
+
+    // See the comment in lessThan() on why we prefer AppName over DisplayRole.
+    QString sortString = index.data(AbstractTasksModel::AppName).toString();
+
+    if (sortString.isEmpty()) {
+        sortString = index.data(Qt::DisplayRole).toString();
+    }
+
+    key.appNameKey = collator.sortKey(sortString);
+}
+
 bool TasksModel::Private::lessThan(const QModelIndex &left, const QModelIndex &right, bool sortOnlyLaunchers) const
 {
+    // If told to stop after launchers we fall through to the existing map if it exists.
+    const bool launchersOnly = (sortOnlyLaunchers && !sortedPreFilterRows.isEmpty());
+
+    // Grow the cache before taking references into it below.
+    if (sortKeysModel && sortKeys.count() < sortKeysModel->rowCount()) {
+        sortKeys.resize(sortKeysModel->rowCount());
+    }
+
+    SortKey leftScratch;
+    SortKey rightScratch;
+    const SortKey &leftKey = sortKey(left, leftScratch, launchersOnly);
+    const SortKey &rightKey = sortKey(right, rightScratch, launchersOnly);
+
     // Launcher tasks go first.
     // When launchInPlace is enabled, startup and window tasks are sorted
     // as the launchers they replace (see also move()).
 
     if (separateLaunchers) {
-        if (left.data(AbstractTasksModel::IsLauncher).toBool() && right.data(AbstractTasksModel::IsLauncher).toBool()) {
+        if (leftKey.isLauncher && rightKey.isLauncher) {
             return (left.row() < right.row());
-        } else if (left.data(AbstractTasksModel::IsLauncher).toBool() && !right.data(AbstractTasksModel::IsLauncher).toBool()) {
-            if (launchInPlace) {
-                const int leftPos = q->launcherPosition(left.data(AbstractTasksModel::LauncherUrlWithoutIcon).toUrl());
-                const int rightPos = q->launcherPosition(right.data(AbstractTasksModel::LauncherUrlWithoutIcon).toUrl());
-
-                if (rightPos != -1) {
-                    return (leftPos < rightPos);
-                }
+        } else if (leftKey.isLauncher && !rightKey.isLauncher) {
+            if (launchInPlace && rightKey.launcherPosition != -1) {
+                return (leftKey.launcherPosition < rightKey.launcherPosition);
             }
 
             return true;
-        } else if (!left.data(AbstractTasksModel::IsLauncher).toBool() && right.data(AbstractTasksModel::IsLauncher).toBool()) {
-            if (launchInPlace) {
-                const int leftPos = q->launcherPosition(left.data(AbstractTasksModel::LauncherUrlWithoutIcon).toUrl());
-                const int rightPos = q->launcherPosition(right.data(AbstractTasksModel::LauncherUrlWithoutIcon).toUrl());
-
-                if (leftPos != -1) {
-                    return (leftPos < rightPos);
-                }
+        } else if (!leftKey.isLauncher && rightKey.isLauncher) {
+            if (launchInPlace && leftKey.launcherPosition != -1) {
+                return (leftKey.launcherPosition < rightKey.launcherPosition);
             }
 
             return false;
         } else if (launchInPlace) {
-            const int leftPos = q->launcherPosition(left.data(AbstractTasksModel::LauncherUrlWithoutIcon).toUrl());
-            const int rightPos = q->launcherPosition(right.data(AbstractTasksModel::LauncherUrlWithoutIcon).toUrl());
+            const int leftPos = leftKey.launcherPosition;
+            const int rightPos = rightKey.launcherPosition;
 
             if (leftPos != -1 && rightPos != -1) {
                 return (leftPos < rightPos);
@@ -873,98 +1202,31 @@ bool TasksModel::Private::lessThan(const QModelIndex &left, const QModelIndex &r
         }
     }
 
-    // If told to stop after launchers we fall through to the existing map if it exists.
-    if (sortOnlyLaunchers && !sortedPreFilterRows.isEmpty()) {
+    if (launchersOnly) {
         return (sortedPreFilterRows.indexOf(left.row()) < sortedPreFilterRows.indexOf(right.row()));
     }
 
     // Sort other cases by sort mode.
     switch (sortMode) {
         case SortVirtualDesktop: {
-            const bool leftAll = left.data(AbstractTasksModel::IsOnAllVirtualDesktops).toBool();
-            const bool rightAll = right.data(AbstractTasksModel::IsOnAllVirtualDesktops).toBool();
-
-            if (leftAll && !rightAll) {
+            if (leftKey.isOnAllVirtualDesktops && !rightKey.isOnAllVirtualDesktops) {
                 return true;
-            } else if (rightAll && !leftAll) {
+            } else if (rightKey.isOnAllVirtualDesktops && !leftKey.isOnAllVirtualDesktops) {
                 return false;
             }
 
-            if (!(leftAll && rightAll)) {
-                const QVariantList &leftDesktops = left.data(AbstractTasksModel::VirtualDesktops).toList();
-                QVariant leftDesktop;
-                int leftDesktopPos = virtualDesktopInfo->numberOfDesktops();
-
-                for (const QVariant &desktop : leftDesktops) {
-                    const int desktopPos = virtualDesktopInfo->position(desktop);
-
-                    if (desktopPos <= leftDesktopPos) {
-                        leftDesktop = desktop;
-                        leftDesktopPos = desktopPos;
-                    }
-                }
-
-                const QVariantList &rightDesktops = right.data(AbstractTasksModel::VirtualDesktops).toList();
-                QVariant rightDesktop;
-                int rightDesktopPos = virtualDesktopInfo->numberOfDesktops();
-
-                for (const QVariant &desktop : rightDesktops) {
-                    const int desktopPos = virtualDesktopInfo->position(desktop);
-
-                    if (desktopPos <= rightDesktopPos) {
-                        rightDesktop = desktop;
-                        rightDesktopPos = desktopPos;
-                    }
-                }
-
-                if (!leftDesktop.isNull() && !rightDesktop.isNull() && (leftDesktop != rightDesktop)) {
-                    return (virtualDesktopInfo->position(leftDesktop) < virtualDesktopInfo->position(rightDesktop));
-                } else if (!leftDesktop.isNull() && rightDesktop.isNull()) {
-                    return false;
-                } else if (leftDesktop.isNull() && !rightDesktop.isNull()) {
-                    return true;
-                }
+            // Tasks on no desktop have the lowest possible position and sort first.
+            if (leftKey.virtualDesktopPosition != rightKey.virtualDesktopPosition) {
+                return (leftKey.virtualDesktopPosition < rightKey.virtualDesktopPosition);
             }
         }
         // fall through
         case SortActivity: {
-            // updateActivityTaskCounts() counts the number of window tasks on each
-            // activity. This will sort tasks by comparing a cumulative score made
-            // up of the task counts for each activity a task is assigned to, and
-            // otherwise fall through to alphabetical sorting.
-            int leftScore = -1;
-            int rightScore = -1;
-
-            const QStringList &leftActivities = left.data(AbstractTasksModel::Activities).toStringList();
-
-            if (!leftActivities.isEmpty()) {
-                foreach(const QString& activity, leftActivities) {
-                    leftScore += activityTaskCounts[activity];
-                }
-            }
-
-            const QStringList &rightActivities = right.data(AbstractTasksModel::Activities).toStringList();
-
-            if (!rightActivities.isEmpty()) {
-                foreach(const QString& activity, rightActivities) {
-                    rightScore += activityTaskCounts[activity];
-                }
-            }
-
-            if (leftScore == -1 || rightScore == -1) {
-                const int sumScore = std::accumulate(activityTaskCounts.constBegin(), activityTaskCounts.constEnd(), 0);
-
-                if (leftScore == -1) {
-                    leftScore = sumScore;
-                }
-
-                if (rightScore == -1) {
-                    rightScore = sumScore;
-                }
-            }
-
-            if (leftScore != rightScore) {
-                return (leftScore > rightScore);
+            // Sort by a cumulative score made up of the task counts for each activity
+            // a task is assigned to (see fillSortKey()), and otherwise fall through to
+            // alphabetical sorting.
+            if (leftKey.activityScore != rightKey.activityScore) {
+                return (leftKey.activityScore > rightKey.activityScore);
             }
         }
         // Fall through to source order if sorting is disabled or manual, or alphabetical by app name otherwise.
@@ -988,21 +1250,10 @@ bool TasksModel::Private::lessThan(const QModelIndex &left, const QModelIndex &r
                 // in case of tabbed apps that have the window title reflect the active tab,
                 // e.g. web browsers). To recap, the common case is "sort by AppName, then
                 // insertion order", only swapping out AppName for DisplayRole (i.e. window
-                // title) when necessary.
-
-                QString leftSortString = left.data(AbstractTasksModel::AppName).toString();
-
-                if (leftSortString.isEmpty()) {
-                    leftSortString = left.data(Qt::DisplayRole).toString();
-                }
+                // title) when necessary. The sort strings are collated once per row in
+                // fillSortKey().
 
-                QString rightSortString = right.data(AbstractTasksModel::AppName).toString();
-
-                if (rightSortString.isEmpty()) {
-                    rightSortString = right.data(Qt::DisplayRole).toString();
-                }
-
-                const int sortResult = leftSortString.localeAwareCompare(rightSortString);
+                const int sortResult = leftKey.appNameKey.compare(rightKey.appNameKey);
 
                 // If the string are identical fall back to source model (creation/append) order.
                 if (sortResult == 0) {
@@ -1211,8 +1462,14 @@ void TasksModel::setSortMode(SortMode mode)
 
             ++d->virtualDesktopInfoUsers;
 
+            // Desktop positions are part of the cached sort keys.
+            connect(d->virtualDesktopInfo, &VirtualDesktopInfo::desktopIdsChanged,
+                this, [this]() { d->scheduleResortChangedRows(); });
+
             setSortRole(AbstractTasksModel::VirtualDesktops);
         } else if (d->sortMode == SortVirtualDesktop) {
+            disconnect(d->virtualDesktopInfo, nullptr, this, nullptr);
+
             --d->virtualDesktopInfoUsers;
 
             if (!d->virtualDesktopInfoUsers) {
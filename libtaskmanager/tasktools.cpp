@@ -19,6 +19,7 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 *********************************************************************/
 
 #include "tasktools.h"
+#include "tasktools_p.h"
 #include "abstracttasksmodel.h"
 
 #include <KActivities/ResourceInstance>
@@ -30,6 +31,7 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 #include <KNotificationJobUiDelegate>
 #include <KServiceTypeTrader>
 #include <KStartupInfo>
+#include <KSycoca>
 #include <KWindowSystem>
 #include <KProcessList>
 
@@ -50,6 +52,165 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 namespace TaskManager
 {
 
+void connectToApplicationsChanged(QObject *context, const std::function<void()> &callback)
+{
+    void (KSycoca::*myDatabaseChangeSignal)(const QStringList &) = &KSycoca::databaseChanged;
+    QObject::connect(KSycoca::self(), myDatabaseChangeSignal, context,
+        [callback](const QStringList &changedResources) {
+            if (changedResources.contains(QLatin1String("services"))
+                || changedResources.contains(QLatin1String("apps"))
+                || changedResources.contains(QLatin1String("xdgdata-apps"))) {
+                callback();
+            }
+        }
+    );
+}
+
+// A session-wide in-memory index over the application services in the sycoca,
+// standing in for KServiceTypeTrader queries of the form "exist Exec and
+// ('value' =~ Property)" for the properties windowUrlFromMetadata() and
+// servicesFromCmdLine() look at. Each trader query is a linear scan over the
+// sycoca; with this, identifying a new window costs a few hash lookups. It is
+// shared by all windowing system backends and rebuilt lazily after sycoca
+// changes.
+class Q_DECL_HIDDEN ApplicationIndex : public QObject
+{
+public:
+    ApplicationIndex();
+
+    // Services whose property matches value case-insensitively, in trader order.
+    KService::List servicesMatching(const QString &property, const QString &value,
+        bool displayedOnly = false);
+    // Services whose DesktopEntryName ends in '.' followed by suffix.
+    KService::List servicesWithDesktopEntryNameSuffix(const QString &suffix);
+
+private:
+    void ensureBuilt();
+    const QHash<QString, KService::List> *index(const QString &property) const;
+
+    bool built = false;
+    QHash<QString, KService::List> startupWMClasses;
+    QHash<QString, KService::List> desktopEntryNames;
+    QHash<QString, KService::List> names;
+    QHash<QString, KService::List> execs;
+    QHash<QString, KService::List> desktopEntryNameSuffixes;
+};
+
+Q_GLOBAL_STATIC(ApplicationIndex, applicationIndex)
+
+ApplicationIndex::ApplicationIndex()
+{
+    connectToApplicationsChanged(this, [this] {
+        built = false;
+    });
+}
+
+void ApplicationIndex::ensureBuilt()
+{
+    // Give KSycoca the chance to notice a changed database (and tell us about
+    // it) the way a trader query would.
+    KSycoca::self()->ensureCacheValid();
+
+    if (built) {
+        return;
+    }
+
+    startupWMClasses.clear();
+    desktopEntryNames.clear();
+    names.clear();
+    execs.clear();
+    desktopEntryNameSuffixes.clear();
+
+    const KService::List services = KServiceTypeTrader::self()->query(QStringLiteral("Application"));
+
+    for (const KService::Ptr &service : services) {
+        if (service->exec().isEmpty()) {
+            continue;
+        }
+
+        const QString &startupWMClass = service->property(QStringLiteral("StartupWMClass")).toString();
+
+        if (!startupWMClass.isEmpty()) {
+            startupWMClasses[startupWMClass.toCaseFolded()].append(service);
+        }
+
+        const QString &desktopEntryName = service->desktopEntryName().toCaseFolded();
+
+        if (!desktopEntryName.isEmpty()) {
+            desktopEntryNames[desktopEntryName].append(service);
+
+            // Every suffix following a dot, for reverse-domain-name matching.
+            for (int dot = desktopEntryName.indexOf(QLatin1Char('.')); dot != -1;
+                dot = desktopEntryName.indexOf(QLatin1Char('.'), dot + 1)) {
+                desktopEntryNameSuffixes[desktopEntryName.mid(dot + 1)].append(service);
+            }
+        }
+
+        if (!service->name().isEmpty()) {
+            names[service->name().toCaseFolded()].append(service);
+        }
+
+        execs[service->exec().toCaseFolded()].append(service);
+    }
+
+    built = true;
+}
+
+const QHash<QString, KService::List> *ApplicationIndex::index(const QString &property) const
+{
+    if (property == QLatin1String("StartupWMClass")) {
+        return &startupWMClasses;
+    } else if (property == QLatin1String("DesktopEntryName")) {
+        return &desktopEntryNames;
+    } else if (property == QLatin1String("Name")) {
+        return &names;
+    } else if (property == QLatin1String("Exec")) {
+        return &execs;
+    }
+
+    return nullptr;
+}
+
+KService::List ApplicationIndex::servicesMatching(const QString &property, const QString &value,
+    bool displayedOnly)
+{
+    ensureBuilt();
+
+    const QHash<QString, KService::List> *propertyIndex = index(property);
+
+    // Rewrite rules may name any property; leave the ones we don't index to the trader.
+    if (!propertyIndex) {
+        QString constraint = QStringLiteral("exist Exec and ('%1' =~ %2)").arg(value, property);
+
+        if (displayedOnly) {
+            constraint.append(QLatin1String(" and (not exist NoDisplay or not NoDisplay)"));
+        }
+
+        return KServiceTypeTrader::self()->query(QStringLiteral("Application"), constraint);
+    }
+
+    KService::List services = propertyIndex->value(value.toCaseFolded());
+
+    if (displayedOnly) {
+        QMutableListIterator<KService::Ptr> it(services);
+
+        while (it.hasNext()) {
+            if (it.next()->property(QStringLiteral("NoDisplay")).toBool()) {
+                it.remove();
+            }
+        }
+    }
+
+    return services;
+}
+
+KService::List ApplicationIndex::servicesWithDesktopEntryNameSuffix(const QString &suffix)
+{
+    ensureBuilt();
+
+    return desktopEntryNameSuffixes.value(suffix.toCaseFolded());
+}
+
 AppData appDataFromUrl(const QUrl &url, const QIcon &fallbackIcon)
 {
     AppData data;
@@ -309,12 +470,12 @@ QUrl windowUrlFromMetadata(const QString &appId, quint32 pid,
             //
             // Source: https://specifications.freedesktop.org/startup-notification-spec/startup-notification-0.1.txt
             if (services.isEmpty()) {
-                services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ StartupWMClass)").arg(appId));
+                services = applicationIndex->servicesMatching(QStringLiteral("StartupWMClass"), appId);
                 sortServicesByMenuId(services, appId);
             }
 
             if (services.isEmpty() && !xWindowsWMClassName.isEmpty()) {
-                services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ StartupWMClass)").arg(xWindowsWMClassName));
+                services = applicationIndex->servicesMatching(QStringLiteral("StartupWMClass"), xWindowsWMClassName);
                 sortServicesByMenuId(services, xWindowsWMClassName);
             }
 
@@ -361,7 +522,7 @@ QUrl windowUrlFromMetadata(const QString &appId, quint32 pid,
                                 rewrittenString = matchProperty;
                             }
 
-                            services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ %2)").arg(rewrittenString, serviceSearchIdentifier));
+                            services = applicationIndex->servicesMatching(serviceSearchIdentifier, rewrittenString);
                             sortServicesByMenuId(services, serviceSearchIdentifier);
 
                             if (!services.isEmpty()) {
@@ -389,26 +550,26 @@ QUrl windowUrlFromMetadata(const QString &appId, quint32 pid,
 
             // Try matching mapped name against DesktopEntryName.
             if (!mapped.isEmpty() && services.isEmpty()) {
-                services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ DesktopEntryName) and (not exist NoDisplay or not NoDisplay)").arg(mapped));
+                services = applicationIndex->servicesMatching(QStringLiteral("DesktopEntryName"), mapped, true);
                 sortServicesByMenuId(services, mapped);
             }
 
             // Try matching mapped name against 'Name'.
             if (!mapped.isEmpty() && services.isEmpty()) {
-                services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ Name) and (not exist NoDisplay or not NoDisplay)").arg(mapped));
+                services = applicationIndex->servicesMatching(QStringLiteral("Name"), mapped, true);
                 sortServicesByMenuId(services, mapped);
             }
 
             // Try matching appId against DesktopEntryName.
             if (services.isEmpty()) {
-                services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ DesktopEntryName) and (not exist NoDisplay or not NoDisplay)").arg(appId));
+                services = applicationIndex->servicesMatching(QStringLiteral("DesktopEntryName"), appId, true);
                 sortServicesByMenuId(services, appId);
             }
 
             // Try matching appId against 'Name'.
             // This has a shaky chance of success as appId is untranslated, but 'Name' may be localized.
             if (services.isEmpty()) {
-                services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ Name) and (not exist NoDisplay or not NoDisplay)").arg(appId));
+                services = applicationIndex->servicesMatching(QStringLiteral("Name"), appId, true);
                 sortServicesByMenuId(services, appId);
             }
 
@@ -450,8 +611,7 @@ QUrl windowUrlFromMetadata(const QString &appId, quint32 pid,
     // - appId also cannot match the binary because of name mismatch
     // - in the following code *.appId can match org.kde.dragonplayer though
     if (services.isEmpty() || services.at(0)->desktopEntryName().isEmpty()) {
-        auto matchingServices = KServiceTypeTrader::self()->query(QStringLiteral("Application"),
-            QStringLiteral("exist Exec and ('%1' ~~ DesktopEntryName)").arg(appId));
+        auto matchingServices = applicationIndex->servicesWithDesktopEntryNameSuffix(appId);
         QMutableListIterator<KService::Ptr> it(matchingServices);
         while (it.hasNext()) {
             auto service = it.next();
@@ -557,14 +717,14 @@ KService::List servicesFromCmdLine(const QString &_cmdLine, const QString &proce
     const int firstSpace = cmdLine.indexOf(' ');
     int slash = 0;
 
-    services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ Exec)").arg(cmdLine));
+    services = applicationIndex->servicesMatching(QStringLiteral("Exec"), cmdLine);
 
     if (services.isEmpty()) {
         // Could not find with complete command line, so strip out the path part ...
         slash = cmdLine.lastIndexOf('/', firstSpace);
 
         if (slash > 0) {
-            services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ Exec)").arg(cmdLine.mid(slash + 1)));
+            services = applicationIndex->servicesMatching(QStringLiteral("Exec"), cmdLine.mid(slash + 1));
         }
     }
 
@@ -572,13 +732,13 @@ KService::List servicesFromCmdLine(const QString &_cmdLine, const QString &proce
         // Could not find with arguments, so try without ...
         cmdLine.truncate(firstSpace);
 
-        services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ Exec)").arg(cmdLine));
+        services = applicationIndex->servicesMatching(QStringLiteral("Exec"), cmdLine);
 
         if (services.isEmpty()) {
             slash = cmdLine.lastIndexOf('/');
 
             if (slash > 0) {
-                services = KServiceTypeTrader::self()->query(QStringLiteral("Application"), QStringLiteral("exist Exec and ('%1' =~ Exec)").arg(cmdLine.mid(slash + 1)));
+                services = applicationIndex->servicesMatching(QStringLiteral("Exec"), cmdLine.mid(slash + 1));
             }
         }
     }
@@ -19,6 +19,7 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 *********************************************************************/
 
 #include "waylandtasksmodel.h"
+#include "appdatastore_p.h"
 #include "tasktools.h"
 #include "virtualdesktopinfo.h"
 
@@ -48,7 +49,7 @@ class Q_DECL_HIDDEN WaylandTasksModel::Private
 public:
     Private(WaylandTasksModel *q);
     QList<KWayland::Client::PlasmaWindow*> windows;
-    QHash<KWayland::Client::PlasmaWindow*, AppData> appDataCache;
+    QHash<KWayland::Client::PlasmaWindow*, AppDataStore::Ptr> appDataCache;
     KWayland::Client::PlasmaWindowManagement *windowManagement = nullptr;
     KSharedConfig::Ptr rulesConfig;
     KDirWatch *configWatcher = nullptr;
@@ -323,15 +324,15 @@ AppData WaylandTasksModel::Private::appData(KWayland::Client::PlasmaWindow *wind
     const auto &it = appDataCache.constFind(window);
 
     if (it != appDataCache.constEnd()) {
-        return *it;
+        return **it;
     }
 
-    const AppData &data = appDataFromUrl(windowUrlFromMetadata(window->appId(),
+    const AppDataStore::Ptr &data = AppDataStore::appData(windowUrlFromMetadata(window->appId(),
         window->pid(), rulesConfig));
 
     appDataCache.insert(window, data);
 
-    return data;
+    return *data;
 }
 
 QIcon WaylandTasksModel::Private::icon(KWayland::Client::PlasmaWindow *window)
@@ -342,9 +343,13 @@ QIcon WaylandTasksModel::Private::icon(KWayland::Client::PlasmaWindow *window)
         return app.icon;
     }
 
-    appDataCache[window].icon = window->icon();
+    // The window icon is specific to this window, so it can't go into the
+    // shared AppData.
+    AppData dataCopy = app;
+    dataCopy.icon = window->icon();
+    appDataCache.insert(window, AppDataStore::unshared(dataCopy));
 
-    return window->icon();
+    return dataCopy.icon;
 }
 
 QString WaylandTasksModel::Private::mimeType()
@@ -23,13 +23,18 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 #include <QTimerEvent>
 #include <QDebug>
 
-#define BATCH_TIME 10
+#define BATCH_TIME_MIN 5
+#define BATCH_TIME_MAX 100
+// Number of cachable events merged into one batch above which we consider
+// ourselves to be in an event storm and lengthen the batch interval.
+#define STORM_THRESHOLD 20
 
 static const NET::Properties s_cachableProperties = NET::WMName | NET::WMVisibleName;
 static const NET::Properties2 s_cachableProperties2 = NET::WM2UserTime;
 
 XWindowSystemEventBatcher::XWindowSystemEventBatcher(QObject* parent)
     : QObject(parent)
+    , m_batchTime(BATCH_TIME_MIN)
 {
     connect(KWindowSystem::self(), &KWindowSystem::windowAdded, this, &XWindowSystemEventBatcher::windowAdded);
 
@@ -43,13 +48,26 @@ XWindowSystemEventBatcher::XWindowSystemEventBatcher(QObject* parent)
         NET::Properties properties, NET::Properties2 properties2) = &KWindowSystem::windowChanged;
     QObject::connect(KWindowSystem::self(), myWindowChangeSignal, this,
         [this](WId window, NET::Properties properties, NET::Properties2 properties2) {
+            ++m_statistics.eventsIn;
+
+            //drop what no consumer is interested in before it gets anywhere
+            if (m_subscribed) {
+                properties &= m_subscription.properties;
+                properties2 &= m_subscription.properties2;
+
+                if (!properties && !properties2) {
+                    return;
+                }
+            }
+
             //if properties contained only cachable flags
             if ((properties | s_cachableProperties) == s_cachableProperties &&
                 (properties2 | s_cachableProperties2) == s_cachableProperties2) {
                 m_cache[window].properties |= properties;
                 m_cache[window].properties2 |= properties2;
+                ++m_batchEvents;
                 if (!m_timerId) {
-                    m_timerId = startTimer(BATCH_TIME);
+                    m_timerId = startTimer(m_batchTime);
                 }
             } else {
                 //submit all caches along with any real updates
@@ -59,21 +77,48 @@ XWindowSystemEventBatcher::XWindowSystemEventBatcher(QObject* parent)
                     properties2 |= it->properties2;
                     m_cache.erase(it);
                 }
-                emit windowChanged(window, properties, properties2);
+                relayWindowChanged(window, properties, properties2);
             }
         }
     );
 }
 
+void XWindowSystemEventBatcher::subscribe(NET::Properties properties, NET::Properties2 properties2)
+{
+    m_subscribed = true;
+    m_subscription.properties |= properties;
+    m_subscription.properties2 |= properties2;
+}
+
+XWindowSystemEventBatcher::Statistics XWindowSystemEventBatcher::statistics() const
+{
+    return m_statistics;
+}
+
+void XWindowSystemEventBatcher::relayWindowChanged(WId window, NET::Properties properties, NET::Properties2 properties2)
+{
+    ++m_statistics.eventsOut;
+    emit windowChanged(window, properties, properties2);
+}
+
 void XWindowSystemEventBatcher::timerEvent(QTimerEvent* event)
 {
     if (event->timerId() != m_timerId) {
         return;
     }
+    m_statistics.maxBatchSize = qMax(m_statistics.maxBatchSize, m_batchEvents);
     for (auto it = m_cache.constBegin(); it!= m_cache.constEnd(); it++) {
-        emit windowChanged(it.key(), it.value().properties, it.value().properties2);
+        relayWindowChanged(it.key(), it.value().properties, it.value().properties2);
     };
     m_cache.clear();
     killTimer(m_timerId);
     m_timerId = 0;
+
+    //back off under storms, react quickly again once they're over
+    if (m_batchEvents > STORM_THRESHOLD) {
+        m_batchTime = qMin(m_batchTime * 2, BATCH_TIME_MAX);
+    } else {
+        m_batchTime = qMax(m_batchTime / 2, BATCH_TIME_MIN);
+    }
+    m_batchEvents = 0;
 }
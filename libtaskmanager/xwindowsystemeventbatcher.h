@@ -28,12 +28,35 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 
 /*
  * Relay class for KWindowSystem events that batches updates
+ *
+ * The batch interval adapts to the event rate: it grows while windows keep
+ * spamming cachable properties (e.g. terminals updating their title) and
+ * shrinks back once things calm down.
  */
 class XWindowSystemEventBatcher : public QObject
 {
     Q_OBJECT
 public:
     XWindowSystemEventBatcher(QObject *parent);
+
+    /*
+     * Adds properties to the set relayed through windowChanged. Changes to
+     * other properties are dropped. Until the first call, all properties
+     * are relayed.
+     */
+    void subscribe(NET::Properties properties, NET::Properties2 properties2);
+
+    /*
+     * Counters for profiling: windowChanged events received from and relayed
+     * to consumers, and the largest number of events merged into one batch.
+     */
+    struct Statistics {
+        quint64 eventsIn = 0;
+        quint64 eventsOut = 0;
+        int maxBatchSize = 0;
+    };
+    Statistics statistics() const;
+
 Q_SIGNALS:
     void windowAdded(WId window);
     void windowRemoved(WId window);
@@ -45,8 +68,15 @@ private:
         NET::Properties properties = {};
         NET::Properties2 properties2 = {};
     };
+    void relayWindowChanged(WId window, NET::Properties properties, NET::Properties2 properties2);
+
     QHash<WId, AllProps> m_cache;
     int m_timerId = 0;
+    int m_batchTime;
+    int m_batchEvents = 0;
+    bool m_subscribed = false;
+    AllProps m_subscription;
+    Statistics m_statistics;
 };
 
 #endif
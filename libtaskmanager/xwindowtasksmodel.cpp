@@ -20,7 +20,9 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 *********************************************************************/
 
 #include "xwindowtasksmodel.h"
+#include "appdatastore_p.h"
 #include "tasktools.h"
+#include "tasktools_p.h"
 #include "xwindowsystemeventbatcher.h"
 
 #include <KDesktopFile>
@@ -29,7 +31,6 @@ License along with this library.  If not, see <http://www.gnu.org/licenses/>.
 #include <KService>
 #include <KSharedConfig>
 #include <KStartupInfo>
-#include <KSycoca>
 #include <KWindowInfo>
 #include <KWindowSystem>
 
@@ -60,7 +61,7 @@ public:
     QMultiHash<WId, WId> transients;
     QMultiHash<WId, WId> transientsDemandingAttention;
     QHash<WId, KWindowInfo*> windowInfoCache;
-    QHash<WId, AppData> appDataCache;
+    QHash<WId, AppDataStore::Ptr> appDataCache;
     QHash<WId, QRect> delegateGeometries;
     QSet<WId> usingFallbackIcon;
     QHash<WId, QTime> lastActivated;
@@ -129,16 +130,9 @@ void XWindowTasksModel::Private::init()
 
     QObject::connect(&sycocaChangeTimer, &QTimer::timeout, q, clearCacheAndRefresh);
 
-    void (KSycoca::*myDatabaseChangeSignal)(const QStringList &) = &KSycoca::databaseChanged;
-    QObject::connect(KSycoca::self(), myDatabaseChangeSignal, q,
-        [this](const QStringList &changedResources) {
-            if (changedResources.contains(QLatin1String("services"))
-                || changedResources.contains(QLatin1String("apps"))
-                || changedResources.contains(QLatin1String("xdgdata-apps"))) {
-                sycocaChangeTimer.start();
-            }
-        }
-    );
+    connectToApplicationsChanged(q, [this] {
+        sycocaChangeTimer.start();
+    });
 
     rulesConfig = KSharedConfig::openConfig(QStringLiteral("taskmanagerrulesrc"));
     configWatcher = new KDirWatch(q);
@@ -158,6 +152,12 @@ void XWindowTasksModel::Private::init()
 
     auto windowSystem = new XWindowSystemEventBatcher(q);
 
+    // The properties windowChanged() and transientChanged() act on.
+    windowSystem->subscribe(NET::WMPid | NET::WMName | NET::WMVisibleName | NET::WMIcon
+        | NET::WMState | NET::XAWMState | NET::WMWindowType | NET::WMDesktop | NET::WMGeometry,
+        NET::WM2DesktopFileName | NET::WM2WindowClass | NET::WM2AllowedActions | NET::WM2Activities
+        | NET::WM2AppMenuServiceName | NET::WM2AppMenuObjectPath | NET::WM2TransientFor);
+
     QObject::connect(windowSystem, &XWindowSystemEventBatcher::windowAdded, q,
         [this](WId window) {
             addWindow(window);
@@ -451,28 +451,28 @@ AppData XWindowTasksModel::Private::appData(WId window)
     const auto &it = appDataCache.constFind(window);
 
     if (it != appDataCache.constEnd()) {
-        return *it;
+        return **it;
     }
 
-    const AppData &data = appDataFromUrl(windowUrl(window));
+    const AppDataStore::Ptr &data = AppDataStore::appData(windowUrl(window));
 
     // If we weren't able to derive a launcher URL from the window meta data,
     // fall back to WM_CLASS Class string as app id. This helps with apps we
     // can't map to an URL due to existing outside the regular system
     // environment, e.g. wine clients.
-    if (data.id.isEmpty() && data.url.isEmpty()) {
-        AppData dataCopy = data;
+    if (data->id.isEmpty() && data->url.isEmpty()) {
+        AppData dataCopy = *data;
 
         dataCopy.id = windowInfo(window)->windowClassClass();
 
-        appDataCache.insert(window, dataCopy);
+        appDataCache.insert(window, AppDataStore::unshared(dataCopy));
 
         return dataCopy;
     }
 
     appDataCache.insert(window, data);
 
-    return data;
+    return *data;
 }
 
 QString XWindowTasksModel::Private::appMenuServiceName(WId window)
@@ -502,7 +502,11 @@ QIcon XWindowTasksModel::Private::icon(WId window)
     icon.addPixmap(KWindowSystem::icon(window, KIconLoader::SizeMedium, KIconLoader::SizeMedium, false));
     icon.addPixmap(KWindowSystem::icon(window, KIconLoader::SizeLarge, KIconLoader::SizeLarge, false));
 
-    appDataCache[window].icon = icon;
+    // The window icon is specific to this window, so it can't go into the
+    // shared AppData.
+    AppData dataCopy = app;
+    dataCopy.icon = icon;
+    appDataCache.insert(window, AppDataStore::unshared(dataCopy));
     usingFallbackIcon.insert(window);
 
     return icon;
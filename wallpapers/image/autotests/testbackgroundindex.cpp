@@ -0,0 +1,149 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "backgroundindex.h"
+
+#include <QDir>
+#include <QStandardPaths>
+#include <QtTest>
+
+class TestBackgroundIndex : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+    void testSaveAndLoad();
+    void testModifiedTime();
+    void testInvalidate();
+    void testRemovePath();
+
+private:
+    void populate(BackgroundIndex &index);
+};
+
+static const QString s_root = QStringLiteral("/wallpapers");
+static const QString s_nature = QStringLiteral("/wallpapers/nature");
+static const QString s_trees = QStringLiteral("/wallpapers/nature/trees");
+
+void TestBackgroundIndex::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void TestBackgroundIndex::init()
+{
+    QDir(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/plasma_wallpaper_image")).removeRecursively();
+}
+
+void TestBackgroundIndex::populate(BackgroundIndex &index)
+{
+    BackgroundIndex::Directory root;
+    root.modified = 100;
+    root.wallpapers = QStringList{s_root + QStringLiteral("/a.png")};
+    root.subdirectories = QStringList{s_nature};
+    index.insert(s_root, root);
+
+    BackgroundIndex::Directory nature;
+    nature.modified = 200;
+    nature.wallpapers = QStringList{s_nature + QStringLiteral("/b.jpg"), s_nature + QStringLiteral("/Package")};
+    nature.subdirectories = QStringList{s_trees};
+    index.insert(s_nature, nature);
+
+    BackgroundIndex::Directory trees;
+    trees.modified = 300;
+    trees.wallpapers = QStringList{s_trees + QStringLiteral("/c.jpg")};
+    index.insert(s_trees, trees);
+}
+
+void TestBackgroundIndex::testSaveAndLoad()
+{
+    {
+        BackgroundIndex index;
+        populate(index);
+        index.save();
+    }
+
+    BackgroundIndex index;
+    BackgroundIndex::Directory directory;
+    QVERIFY(index.lookup(s_nature, 200, &directory));
+    QCOMPARE(directory.modified, qint64(200));
+    QCOMPARE(directory.wallpapers, QStringList({s_nature + QStringLiteral("/b.jpg"), s_nature + QStringLiteral("/Package")}));
+    QCOMPARE(directory.subdirectories, QStringList{s_trees});
+
+    QCOMPARE(index.wallpapers(QStringList{s_root}),
+             QStringList({s_root + QStringLiteral("/a.png"),
+                          s_nature + QStringLiteral("/b.jpg"), s_nature + QStringLiteral("/Package"),
+                          s_trees + QStringLiteral("/c.jpg")}));
+}
+
+void TestBackgroundIndex::testModifiedTime()
+{
+    BackgroundIndex index;
+    populate(index);
+
+    BackgroundIndex::Directory directory;
+    QVERIFY(index.lookup(s_trees, 300, &directory));
+    QVERIFY(!index.lookup(s_trees, 301, &directory));
+    QVERIFY(!index.lookup(QStringLiteral("/elsewhere"), 300, &directory));
+
+    // Indexing the directory again drops subdirectories that are gone
+    BackgroundIndex::Directory nature;
+    nature.modified = 201;
+    nature.wallpapers = QStringList{s_nature + QStringLiteral("/b.jpg")};
+    index.insert(s_nature, nature);
+
+    QVERIFY(index.lookup(s_nature, 201, &directory));
+    QVERIFY(!index.lookup(s_nature, 200, &directory));
+    QVERIFY(!index.lookup(s_trees, 300, &directory));
+}
+
+void TestBackgroundIndex::testInvalidate()
+{
+    BackgroundIndex index;
+    populate(index);
+
+    index.invalidate(s_nature);
+
+    BackgroundIndex::Directory directory;
+    QVERIFY(!index.lookup(s_nature, 200, &directory));
+    QVERIFY(index.lookup(s_trees, 300, &directory));
+    // What was found is still shown until the directory is scanned again
+    QCOMPARE(index.wallpapers(QStringList{s_nature}).count(), 3);
+}
+
+void TestBackgroundIndex::testRemovePath()
+{
+    BackgroundIndex index;
+    populate(index);
+
+    index.removePath(s_nature + QStringLiteral("/b.jpg"));
+
+    BackgroundIndex::Directory directory;
+    QVERIFY(!index.lookup(s_nature, 200, &directory));
+    QCOMPARE(index.wallpapers(QStringList{s_nature}),
+             QStringList({s_nature + QStringLiteral("/Package"), s_trees + QStringLiteral("/c.jpg")}));
+
+    index.removePath(s_nature);
+
+    QVERIFY(!index.lookup(s_root, 100, &directory));
+    QCOMPARE(index.wallpapers(QStringList{s_root}), QStringList{s_root + QStringLiteral("/a.png")});
+    QVERIFY(index.wallpapers(QStringList{s_trees}).isEmpty());
+}
+
+QTEST_MAIN(TestBackgroundIndex)
+#include "testbackgroundindex.moc"
@@ -0,0 +1,250 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "backgroundindex.h"
+#include "debug.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTimer>
+
+static const quint32 INDEX_MAGIC = 0x50574931; // "PWI1"
+static const quint32 INDEX_VERSION = 1;
+
+Q_GLOBAL_STATIC(BackgroundIndex, s_backgroundIndex)
+
+BackgroundIndex::BackgroundIndex()
+    : m_fileName(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/plasma_wallpaper_image/index"))
+    , m_saveTimer(new QTimer(this))
+{
+    // The index may be created from a finder thread first, but it is saved from the main thread
+    if (QCoreApplication::instance()) {
+        moveToThread(QCoreApplication::instance()->thread());
+        connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &BackgroundIndex::save);
+    }
+
+    m_saveTimer->setSingleShot(true);
+    m_saveTimer->setInterval(5000);
+    connect(m_saveTimer, &QTimer::timeout, this, &BackgroundIndex::save);
+
+    load();
+}
+
+BackgroundIndex::~BackgroundIndex() = default;
+
+BackgroundIndex *BackgroundIndex::self()
+{
+    return s_backgroundIndex();
+}
+
+bool BackgroundIndex::lookup(const QString &path, qint64 modified, Directory *directory) const
+{
+    QMutexLocker lock(&m_mutex);
+
+    const auto it = m_directories.constFind(path);
+    if (it == m_directories.constEnd() || it->modified == -1 || it->modified != modified) {
+        return false;
+    }
+
+    *directory = *it;
+    return true;
+}
+
+void BackgroundIndex::insert(const QString &path, const Directory &directory)
+{
+    QMutexLocker lock(&m_mutex);
+
+    // Forget about subdirectories that are gone
+    const auto it = m_directories.constFind(path);
+    if (it != m_directories.constEnd()) {
+        const QStringList oldSubdirectories = it->subdirectories;
+        for (const QString &subdirectory : oldSubdirectories) {
+            if (!directory.subdirectories.contains(subdirectory)) {
+                removeLocked(subdirectory);
+            }
+        }
+    }
+
+    m_directories.insert(path, directory);
+    m_dirty = true;
+}
+
+void BackgroundIndex::remove(const QString &path)
+{
+    QMutexLocker lock(&m_mutex);
+    removeLocked(path);
+}
+
+void BackgroundIndex::removeLocked(const QString &path)
+{
+    const auto it = m_directories.find(path);
+    if (it == m_directories.end()) {
+        return;
+    }
+
+    const QStringList subdirectories = it->subdirectories;
+    m_directories.erase(it);
+    m_dirty = true;
+
+    for (const QString &subdirectory : subdirectories) {
+        removeLocked(subdirectory);
+    }
+}
+
+QStringList BackgroundIndex::wallpapers(const QStringList &paths) const
+{
+    QMutexLocker lock(&m_mutex);
+
+    QStringList wallpapers;
+    QStringList pending = paths;
+    for (int i = 0; i < pending.count(); ++i) {
+        const auto it = m_directories.constFind(pending.at(i));
+        if (it == m_directories.constEnd()) {
+            continue;
+        }
+        wallpapers << it->wallpapers;
+        pending << it->subdirectories;
+    }
+
+    return wallpapers;
+}
+
+void BackgroundIndex::addWallpaper(const QString &path)
+{
+    QMutexLocker lock(&m_mutex);
+
+    const auto it = m_directories.find(QFileInfo(path).absolutePath());
+    if (it == m_directories.end()) {
+        return;
+    }
+
+    if (!it->wallpapers.contains(path)) {
+        it->wallpapers.append(path);
+    }
+    // Let the next scan list the directory again, it may have changed in other ways too
+    it->modified = -1;
+    m_dirty = true;
+}
+
+void BackgroundIndex::removePath(const QString &path)
+{
+    QMutexLocker lock(&m_mutex);
+
+    removeLocked(path);
+
+    const auto it = m_directories.find(QFileInfo(path).absolutePath());
+    if (it == m_directories.end()) {
+        return;
+    }
+
+    it->wallpapers.removeAll(path);
+    it->subdirectories.removeAll(path);
+    it->modified = -1;
+    m_dirty = true;
+}
+
+void BackgroundIndex::invalidate(const QString &path)
+{
+    QMutexLocker lock(&m_mutex);
+
+    const auto it = m_directories.find(path);
+    if (it != m_directories.end() && it->modified != -1) {
+        it->modified = -1;
+        m_dirty = true;
+    }
+}
+
+void BackgroundIndex::scheduleSave()
+{
+    QMetaObject::invokeMethod(m_saveTimer, QOverload<>::of(&QTimer::start), Qt::QueuedConnection);
+}
+
+void BackgroundIndex::load()
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    stream >> magic >> version;
+    if (magic != INDEX_MAGIC || version != INDEX_VERSION) {
+        return;
+    }
+
+    quint32 count = 0;
+    stream >> count;
+
+    QHash<QString, Directory> directories;
+    directories.reserve(count);
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString path;
+        Directory directory;
+        stream >> path >> directory.modified >> directory.wallpapers >> directory.subdirectories;
+        directories.insert(path, directory);
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(IMAGEWALLPAPER) << "Failed to read wallpaper index" << m_fileName;
+        return;
+    }
+
+    QMutexLocker lock(&m_mutex);
+    m_directories = directories;
+}
+
+void BackgroundIndex::save()
+{
+    QHash<QString, Directory> directories;
+    {
+        QMutexLocker lock(&m_mutex);
+        if (!m_dirty) {
+            return;
+        }
+        directories = m_directories;
+        m_dirty = false;
+    }
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(IMAGEWALLPAPER) << "Failed to write wallpaper index" << m_fileName << file.errorString();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << INDEX_MAGIC << INDEX_VERSION << quint32(directories.count());
+    for (auto it = directories.constBegin(); it != directories.constEnd(); ++it) {
+        stream << it.key() << it->modified << it->wallpapers << it->subdirectories;
+    }
+
+    if (!file.commit()) {
+        qCWarning(IMAGEWALLPAPER) << "Failed to write wallpaper index" << m_fileName << file.errorString();
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef BACKGROUNDINDEX_H
+#define BACKGROUNDINDEX_H
+
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+
+class QTimer;
+
+/**
+ * Persistent index of the wallpapers found in directories, shared by all
+ * BackgroundFinder threads of the process.
+ *
+ * For every scanned directory it stores the wallpapers (image files and
+ * packages) found directly inside and the subdirectories to descend into,
+ * along with the modification time of the directory at that point. As long
+ * as that time doesn't change, the directory doesn't need to be listed again.
+ */
+class BackgroundIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Directory {
+        qint64 modified = -1;
+        QStringList wallpapers;
+        QStringList subdirectories;
+    };
+
+    BackgroundIndex();
+    ~BackgroundIndex() override;
+
+    static BackgroundIndex *self();
+
+    /**
+     * Looks up @p path in the index.
+     * @returns false if it isn't indexed or was modified at a time other than @p modified
+     */
+    bool lookup(const QString &path, qint64 modified, Directory *directory) const;
+    void insert(const QString &path, const Directory &directory);
+    /**
+     * Removes @p path and everything indexed below it.
+     */
+    void remove(const QString &path);
+
+    /**
+     * All wallpapers indexed below @p paths, in the order a scan finds them,
+     * without touching the file system.
+     */
+    QStringList wallpapers(const QStringList &paths) const;
+
+    // Incremental updates from KDirWatch
+    void addWallpaper(const QString &path);
+    void removePath(const QString &path);
+    void invalidate(const QString &path);
+
+    /**
+     * Writes the index to disk shortly, can be called from any thread.
+     */
+    void scheduleSave();
+    /**
+     * Writes the index to disk right away if it changed.
+     */
+    void save();
+
+private:
+    void load();
+    void removeLocked(const QString &path);
+
+    QString m_fileName;
+    mutable QMutex m_mutex;
+    QHash<QString, Directory> m_directories;
+    bool m_dirty = false;
+    QTimer *m_saveTimer;
+};
+
+#endif // BACKGROUNDINDEX_H
@@ -22,6 +22,7 @@
 
 #include "debug.h"
 #include "backgroundlistmodel.h"
+#include "backgroundindex.h"
 
 #include <QFile>
 #include <QDir>
@@ -35,6 +36,10 @@
 #include <QMimeType>
 #include <QMutexLocker>
 #include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QSaveFile>
+#include <QAtomicInt>
+#include <QDateTime>
 
 #include <QDebug>
 #include <KIO/PreviewJob>
@@ -49,6 +54,21 @@
 
 QStringList BackgroundFinder::s_suffixes;
 QMutex BackgroundFinder::s_suffixMutex;
+QMutex BackgroundFinder::s_packageMutex;
+
+// How often wallpapers found so far are handed to the model during a scan
+static const int BATCH_INTERVAL = 100;
+
+// Previews kept in memory, in multiples of the cells visible at once
+static const int PREVIEW_CACHE_SCREENS = 3;
+static const int MIN_CACHED_PREVIEWS = 32;
+// Size of the previews on disk, pruned to three quarters when exceeded
+static const qint64 MAX_PREVIEW_CACHE_SIZE = 100 * 1024 * 1024;
+// Number of previews saved between checks of the size of the cache
+static const int PREVIEW_CACHE_CHECK_INTERVAL = 64;
+
+static QAtomicInt s_previewsSaved;
+static QAtomicInt s_pruningPreviews;
 
 ImageSizeFinder::ImageSizeFinder(const QString &path, QObject *parent)
     : QObject(parent),
@@ -62,15 +82,131 @@ void ImageSizeFinder::run()
     Q_EMIT sizeFound(m_path, reader.size());
 }
 
+PreviewLoader::PreviewLoader(const QStringList &paths, const QSize &size, QObject *parent)
+    : QObject(parent),
+      m_paths(paths),
+      m_size(size)
+{
+}
+
+void PreviewLoader::run()
+{
+    QHash<QString, QImage> previews;
+    QStringList missing;
+
+    for (const QString &path : qAsConst(m_paths)) {
+        const QString fileName = cacheFileName(path, m_size);
+        QImage preview;
+        if (!fileName.isEmpty() && preview.load(fileName, "PNG")) {
+            previews.insert(path, preview);
+            // Pruning goes by modification time, mark it as recently used
+            QFile file(fileName);
+            if (file.open(QIODevice::ReadWrite)) {
+                file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+            }
+        } else {
+            missing << path;
+        }
+    }
+
+    Q_EMIT previewsLoaded(previews, missing);
+}
+
+QString PreviewLoader::cacheFileName(const QString &path, const QSize &size)
+{
+    const QFileInfo info(path);
+    if (!info.exists()) {
+        return QString();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(path.toUtf8());
+    hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+    hash.addData(QByteArray::number(info.size()));
+    hash.addData(QByteArray::number(size.width()) + 'x' + QByteArray::number(size.height()));
+
+    return cacheDirectory() + QLatin1Char('/') + QString::fromLatin1(hash.result().toHex()) + QStringLiteral(".png");
+}
+
+QString PreviewLoader::cacheDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/plasma_wallpaper_image/previews");
+}
+
+void PreviewLoader::prune()
+{
+    // Only one thread of the process needs to do this
+    if (!s_pruningPreviews.testAndSetAcquire(0, 1)) {
+        return;
+    }
+
+    QDir dir(cacheDirectory());
+    const QFileInfoList entries = dir.entryInfoList({QStringLiteral("*.png")}, QDir::Files, QDir::Time);
+
+    qint64 size = 0;
+    for (const QFileInfo &entry : entries) {
+        size += entry.size();
+    }
+
+    // Newest first, so remove from the end
+    if (size > MAX_PREVIEW_CACHE_SIZE) {
+        for (int i = entries.count() - 1; i >= 0 && size > MAX_PREVIEW_CACHE_SIZE * 3 / 4; --i) {
+            if (QFile::remove(entries.at(i).filePath())) {
+                size -= entries.at(i).size();
+            }
+        }
+    }
+
+    s_pruningPreviews.storeRelease(0);
+}
+
+void PreviewLoader::save(const QString &path, const QSize &size, const QImage &preview)
+{
+    QThreadPool::globalInstance()->start([path, size, preview] {
+        const QString fileName = cacheFileName(path, size);
+        if (fileName.isEmpty()) {
+            return;
+        }
+
+        QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+        QSaveFile file(fileName);
+        if (file.open(QIODevice::WriteOnly) && preview.save(&file, "PNG")) {
+            file.commit();
+        }
+
+        if (s_previewsSaved.fetchAndAddRelaxed(1) % PREVIEW_CACHE_CHECK_INTERVAL == 0) {
+            prune();
+        }
+    });
+}
+
 
 BackgroundListModel::BackgroundListModel(Image *wallpaper, QObject *parent)
     : QAbstractListModel(parent),
       m_wallpaper(wallpaper)
 {
-    m_imageCache.setMaxCost(10 * 1024 * 1024); // 10 MiB
+    // Every preview costs 1, grown with the number of visible cells
+    m_imageCache.setMaxCost(MIN_CACHED_PREVIEWS);
+
+    // Collect the requests of all delegates created in one go
+    m_previewRequestTimer.setSingleShot(true);
+    m_previewRequestTimer.setInterval(0);
+    connect(&m_previewRequestTimer, &QTimer::timeout, this, &BackgroundListModel::processPreviewRequests);
 
     connect(&m_dirwatch, &KDirWatch::deleted, this, &BackgroundListModel::removeBackground);
 
+    // Any change to the rows may move them, look them up again when the next previews arrive
+    auto invalidatePreviewRows = [this] {
+        m_previewRows.clear();
+    };
+    connect(this, &QAbstractItemModel::modelReset, this, invalidatePreviewRows);
+    connect(this, &QAbstractItemModel::rowsInserted, this, invalidatePreviewRows);
+    connect(this, &QAbstractItemModel::rowsRemoved, this, invalidatePreviewRows);
+    connect(this, &QAbstractItemModel::rowsMoved, this, invalidatePreviewRows);
+    connect(this, &QAbstractItemModel::layoutChanged, this, invalidatePreviewRows);
+
     //TODO: on Qt 4.4 use the ui scale factor
     QFontMetrics fm(QGuiApplication::font());
     m_screenshotSize = fm.horizontalAdvance('M') * 15;
@@ -123,15 +259,42 @@ void BackgroundListModel::reload(const QStringList &selected)
 
     BackgroundFinder *finder = new BackgroundFinder(m_wallpaper.data(), dirs);
     const auto token = finder->token();
+    connect(finder, &BackgroundFinder::backgroundsBatchFound, this, [this, token] (const QStringList &wallpapersFound) {
+        if (token != m_findToken || !m_wallpaper) {
+            return;
+        }
+
+        QStringList newPaths;
+        for (const QString &path : wallpapersFound) {
+            if (!m_shownPaths.contains(path)) {
+                m_shownPaths.insert(path);
+                newPaths << path;
+            }
+        }
+        appendPaths(newPaths);
+    });
     connect(finder, &BackgroundFinder::backgroundsFound, this, [this, selected, token] (const QStringList &wallpapersFound) {
         if (token != m_findToken || !m_wallpaper) {
             return;
         }
 
-        processPaths(selected + wallpapersFound);
-        m_removableWallpapers = QSet<QString>(selected.constBegin(), selected.constEnd());
+        // The batches only ever add and come in no particular order, reset
+        // the model if the scan ended up with something else
+        const QStringList paths = selected + wallpapersFound;
+        if (QSet<QString>(paths.constBegin(), paths.constEnd()) != m_shownPaths) {
+            processPaths(paths);
+        }
+        m_shownPaths.clear();
     });
     m_findToken = token;
+
+    // Show the user's own wallpapers and what was found last time right away,
+    // the scan adds the rest as it goes
+    const QStringList shownPaths = selected + BackgroundIndex::self()->wallpapers(dirs);
+    m_removableWallpapers = QSet<QString>(selected.constBegin(), selected.constEnd());
+    m_shownPaths = QSet<QString>(shownPaths.constBegin(), shownPaths.constEnd());
+    processPaths(shownPaths);
+
     finder->start();
 }
 
@@ -140,6 +303,30 @@ void BackgroundListModel::processPaths(const QStringList &paths)
     beginResetModel();
     m_packages.clear();
 
+    const QList<KPackage::Package> newPackages = loadPackages(paths);
+    if (!newPackages.isEmpty()) {
+        m_packages.append(newPackages);
+    }
+    endResetModel();
+    emit countChanged();
+    //qCDebug(IMAGEWALLPAPER) << t.elapsed();
+}
+
+void BackgroundListModel::appendPaths(const QStringList &paths)
+{
+    const QList<KPackage::Package> newPackages = loadPackages(paths);
+    if (newPackages.isEmpty()) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), m_packages.count(), m_packages.count() + newPackages.count() - 1);
+    m_packages.append(newPackages);
+    endInsertRows();
+    emit countChanged();
+}
+
+QList<KPackage::Package> BackgroundListModel::loadPackages(const QStringList &paths)
+{
     QList<KPackage::Package> newPackages;
     newPackages.reserve(paths.count());
     for (QString file : paths) {
@@ -163,17 +350,14 @@ void BackgroundListModel::processPaths(const QStringList &paths)
         }
 
         // so now we have a path to a package, check if we're not
-        // processing the same path twice (this is different from
-        // the "!contains(file)" call lower down, that one checks paths
-        // already in the model and does not include the paths
-        // that are being checked in here); we want to check for duplicates
+        // processing the same path twice; we want to check for duplicates
         // if and only if we actually changed the path (so the conditions from above
         // are reused here as that means we did change the path)
         if ((info.isSymLink() || contentsIndex != -1) && paths.contains(file)) {
             continue;
         }
 
-        if (!contains(file) && QFile::exists(file)) {
+        if (QFile::exists(file)) {
             KPackage::Package package = KPackage::PackageLoader::self()->loadPackage(QStringLiteral("Wallpaper/Images"));
             package.setPath(file);
             if (package.isValid()) {
@@ -190,12 +374,7 @@ void BackgroundListModel::processPaths(const QStringList &paths)
         }
     }
 
-    if (!newPackages.isEmpty()) {
-        m_packages.append(newPackages);
-    }
-    endResetModel();
-    emit countChanged();
-    //qCDebug(IMAGEWALLPAPER) << t.elapsed();
+    return newPackages;
 }
 
 void BackgroundListModel::addBackground(const QString& path)
@@ -333,22 +512,7 @@ QVariant BackgroundListModel::data(const QModelIndex &index, int role) const
             return *cachedPreview;
         }
 
-        const QUrl url = QUrl::fromLocalFile(path);
-        const QPersistentModelIndex persistentIndex(index);
-        if (!m_previewJobsUrls.contains(persistentIndex) && url.isValid()) {
-            KFileItemList list;
-            list.append(KFileItem(url, QString(), 0));
-            QStringList availablePlugins = KIO::PreviewJob::availablePlugins();
-            KIO::PreviewJob* job = KIO::filePreview(list,
-                                                    QSize(m_screenshotSize*1.6,
-                                                    m_screenshotSize),  &availablePlugins);
-            job->setIgnoreMaximumSize(true);
-            connect(job, &KIO::PreviewJob::gotPreview,
-                    this, &BackgroundListModel::showPreview);
-            connect(job, &KIO::PreviewJob::failed,
-                    this, &BackgroundListModel::previewFailed);
-            const_cast<BackgroundListModel *>(this)->m_previewJobsUrls.insert(persistentIndex, url);
-        }
+        const_cast<BackgroundListModel *>(this)->requestPreview(index, path);
 
         return QVariant();
     }
@@ -416,34 +580,129 @@ bool BackgroundListModel::setData(const QModelIndex &index, const QVariant &valu
     return false;
 }
 
-void BackgroundListModel::showPreview(const KFileItem &item, const QPixmap &preview)
+QSize BackgroundListModel::previewSize() const
+{
+    return QSize(m_screenshotSize * 1.6, m_screenshotSize);
+}
+
+void BackgroundListModel::requestPreview(const QModelIndex &index, const QString &path)
+{
+    if (path.isEmpty() || m_pendingPreviews.contains(path)) {
+        return;
+    }
+
+    m_requestedPreviews.insert(path, QPersistentModelIndex(index));
+    if (!m_previewRequestTimer.isActive()) {
+        m_previewRequestTimer.start();
+    }
+}
+
+void BackgroundListModel::processPreviewRequests()
+{
+    if (m_requestedPreviews.isEmpty()) {
+        return;
+    }
+
+    // Keep previews for a few screens worth of cells around
+    m_visiblePreviews = qMax(m_visiblePreviews, m_requestedPreviews.count());
+    m_imageCache.setMaxCost(qMax(MIN_CACHED_PREVIEWS, m_visiblePreviews * PREVIEW_CACHE_SCREENS));
+
+    // Also prepare the cells that come into view next when scrolling down
+    int lastRow = -1;
+    for (const QPersistentModelIndex &index : qAsConst(m_requestedPreviews)) {
+        lastRow = qMax(lastRow, index.row());
+    }
+    const int prefetchEnd = qMin(lastRow + m_requestedPreviews.count(), m_packages.count() - 1);
+    for (int row = lastRow + 1; row <= prefetchEnd; ++row) {
+        const QString path = m_packages.at(row).filePath("preferred");
+        if (!path.isEmpty() && !m_imageCache.contains(path) && !m_pendingPreviews.contains(path)) {
+            m_requestedPreviews.insert(path, QPersistentModelIndex(index(row, 0)));
+        }
+    }
+
+    QStringList paths;
+    paths.reserve(m_requestedPreviews.count());
+    for (auto it = m_requestedPreviews.constBegin(); it != m_requestedPreviews.constEnd(); ++it) {
+        m_pendingPreviews.insert(it.key());
+        paths << it.key();
+    }
+    m_requestedPreviews.clear();
+
+    PreviewLoader *loader = new PreviewLoader(paths, previewSize());
+    connect(loader, &PreviewLoader::previewsLoaded, this, &BackgroundListModel::previewsLoaded);
+    QThreadPool::globalInstance()->start(loader);
+}
+
+void BackgroundListModel::previewsLoaded(const QHash<QString, QImage> &previews, const QStringList &missing)
 {
     if (!m_wallpaper) {
         return;
     }
 
-    QPersistentModelIndex index = m_previewJobsUrls.key(item.url());
-    m_previewJobsUrls.remove(index);
+    QHash<QString, QPixmap> pixmaps;
+    pixmaps.reserve(previews.count());
+    for (auto it = previews.constBegin(); it != previews.constEnd(); ++it) {
+        pixmaps.insert(it.key(), QPixmap::fromImage(it.value()));
+    }
+    setPreviews(pixmaps);
 
-    if (!index.isValid()) {
+    if (missing.isEmpty()) {
         return;
     }
 
-    KPackage::Package b = package(index.row());
-    if (!b.isValid()) {
+    // Generate all previews that aren't cached yet in a single job
+    KFileItemList list;
+    list.reserve(missing.count());
+    for (const QString &path : missing) {
+        list.append(KFileItem(QUrl::fromLocalFile(path), QString(), 0));
+    }
+
+    QStringList availablePlugins = KIO::PreviewJob::availablePlugins();
+    KIO::PreviewJob* job = KIO::filePreview(list, previewSize(), &availablePlugins);
+    job->setIgnoreMaximumSize(true);
+    connect(job, &KIO::PreviewJob::gotPreview,
+            this, &BackgroundListModel::showPreview);
+    connect(job, &KIO::PreviewJob::failed,
+            this, &BackgroundListModel::previewFailed);
+}
+
+void BackgroundListModel::showPreview(const KFileItem &item, const QPixmap &preview)
+{
+    if (!m_wallpaper) {
         return;
     }
 
-    const int cost = preview.width() * preview.height() * preview.depth() / 8;
-    m_imageCache.insert(b.filePath("preferred"), new QPixmap(preview), cost);
+    const QString path = item.url().toLocalFile();
+    PreviewLoader::save(path, previewSize(), preview.toImage());
+    setPreviews({{path, preview}});
+}
 
-    //qCDebug(IMAGEWALLPAPER) << "WP preview size:" << preview.size();
-    emit dataChanged(index, index);
+void BackgroundListModel::setPreviews(const QHash<QString, QPixmap> &previews)
+{
+    for (auto it = previews.constBegin(); it != previews.constEnd(); ++it) {
+        m_pendingPreviews.remove(it.key());
+        m_imageCache.insert(it.key(), new QPixmap(it.value()), 1);
+    }
+
+    // Look the rows up now, they may have changed since the previews were requested
+    if (m_previewRows.isEmpty()) {
+        m_previewRows.reserve(m_packages.count());
+        for (int row = 0; row < m_packages.count(); ++row) {
+            m_previewRows.insert(m_packages.at(row).filePath("preferred"), row);
+        }
+    }
+
+    for (auto it = previews.constBegin(); it != previews.constEnd(); ++it) {
+        for (auto rowIt = m_previewRows.constFind(it.key()); rowIt != m_previewRows.constEnd() && rowIt.key() == it.key(); ++rowIt) {
+            const QModelIndex idx = index(rowIt.value(), 0);
+            emit dataChanged(idx, idx);
+        }
+    }
 }
 
 void BackgroundListModel::previewFailed(const KFileItem &item)
 {
-    m_previewJobsUrls.remove(m_previewJobsUrls.key(item.url()));
+    m_pendingPreviews.remove(item.url().toLocalFile());
 }
 
 KPackage::Package BackgroundListModel::package(int index) const
@@ -479,6 +738,8 @@ BackgroundFinder::BackgroundFinder(Image *wallpaper, const QStringList &paths)
       m_paths(paths),
       m_token(QUuid::createUuid().toString())
 {
+    // Scanning is mostly waiting for stat() calls, so run a few of them in parallel
+    m_pool.setMaxThreadCount(qBound(2, QThread::idealThreadCount(), 8));
 }
 
 BackgroundFinder::~BackgroundFinder()
@@ -526,17 +787,47 @@ void BackgroundFinder::run()
     QElapsedTimer t;
     t.start();
 
-    QStringList papersFound;
+    // Every directory is scanned by a task of its own, which starts the
+    // tasks for its subdirectories
+    for (const QString &path : qAsConst(m_paths)) {
+        m_pool.start([this, path] {
+            scanDirectory(path);
+        });
+    }
+
+    while (!m_pool.waitForDone(BATCH_INTERVAL)) {
+        emitBatch();
+    }
+    emitBatch();
+
+    // The tasks finish in any order, the index knows the order a sequential scan would yield
+    const QStringList papersFound = BackgroundIndex::self()->wallpapers(m_paths);
+    BackgroundIndex::self()->scheduleSave();
+
+    //qCDebug(IMAGEWALLPAPER) << "WP background found!" << papersFound.size() << "taking" << t.elapsed() << "ms";
+    Q_EMIT backgroundsFound(papersFound, m_token);
+    deleteLater();
+}
+
+void BackgroundFinder::scanDirectory(const QString &path)
+{
+    BackgroundIndex *index = BackgroundIndex::self();
 
-    QDir dir;
-    dir.setFilter(QDir::AllDirs | QDir::Files | QDir::Readable);
-    dir.setNameFilters(suffixes());
-    KPackage::Package package = KPackage::PackageLoader::self()->loadPackage(QStringLiteral("Wallpaper/Images"));
+    const QFileInfo pathInfo(path);
+    if (!pathInfo.isDir()) {
+        index->remove(path);
+        return;
+    }
+
+    // Only directories whose entries changed since the last scan are listed again
+    const qint64 modified = pathInfo.lastModified().toMSecsSinceEpoch();
+    BackgroundIndex::Directory indexed;
+    if (!index->lookup(path, modified, &indexed)) {
+        indexed.modified = modified;
 
-    int i;
-    for (i = 0; i < m_paths.count(); ++i) {
-        const QString path = m_paths.at(i);
-        dir.setPath(path);
+        QDir dir(path);
+        dir.setFilter(QDir::AllDirs | QDir::Files | QDir::Readable);
+        dir.setNameFilters(suffixes());
         const QFileInfoList files = dir.entryInfoList();
         for (const QFileInfo &wp : files) {
             if (wp.isDir()) {
@@ -550,10 +841,12 @@ void BackgroundFinder::run()
 
                 const QString filePath = wp.filePath();
                 if (QFile::exists(filePath + QString::fromLatin1("/metadata.desktop")) || QFile::exists(filePath + QString::fromLatin1("/metadata.json"))) {
+                    QMutexLocker lock(&s_packageMutex);
+                    KPackage::Package package = KPackage::PackageLoader::self()->loadPackage(QStringLiteral("Wallpaper/Images"));
                     package.setPath(filePath);
                     if (package.isValid()) {
                         if (!package.filePath("images").isEmpty()) {
-                            papersFound << package.path();
+                            indexed.wallpapers << package.path();
                         }
                         //qCDebug(IMAGEWALLPAPER) << "adding package" << wp.filePath();
                         continue;
@@ -561,19 +854,40 @@ void BackgroundFinder::run()
                 }
 
                 // add this to the directories we should be looking at
-                m_paths.append(filePath);
+                indexed.subdirectories << filePath;
             } else {
                 //qCDebug(IMAGEWALLPAPER) << "adding image file" << wp.filePath();
-                papersFound << wp.filePath();
+                indexed.wallpapers << wp.filePath();
             }
         }
+
+        index->insert(path, indexed);
     }
 
-    //qCDebug(IMAGEWALLPAPER) << "WP background found!" << papersFound.size() << "in" << i << "dirs, taking" << t.elapsed() << "ms";
-    Q_EMIT backgroundsFound(papersFound, m_token);
-    deleteLater();
+    for (const QString &subdirectory : qAsConst(indexed.subdirectories)) {
+        m_pool.start([this, subdirectory] {
+            scanDirectory(subdirectory);
+        });
+    }
+
+    if (!indexed.wallpapers.isEmpty()) {
+        QMutexLocker lock(&m_batchMutex);
+        m_batch << indexed.wallpapers;
+    }
 }
 
+void BackgroundFinder::emitBatch()
+{
+    QStringList batch;
+    {
+        QMutexLocker lock(&m_batchMutex);
+        batch.swap(m_batch);
+    }
+
+    if (!batch.isEmpty()) {
+        Q_EMIT backgroundsBatchFound(batch, m_token);
+    }
+}
 
 
 #endif // BACKGROUNDLISTMODEL_CPP
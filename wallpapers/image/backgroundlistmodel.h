@@ -24,11 +24,14 @@
 
 #include <QAbstractListModel>
 #include <QCache>
+#include <QHash>
 #include <QPixmap>
 #include <QRunnable>
 #include <QThread>
+#include <QThreadPool>
 #include <QMutex>
 #include <QSet>
+#include <QTimer>
 
 #include <KDirWatch>
 #include <KFileItem>
@@ -52,6 +55,34 @@ class ImageSizeFinder : public QObject, public QRunnable
         QString m_path;
 };
 
+/**
+ * Looks up previews in the on-disk cache shared by all processes showing
+ * wallpapers. Previews are keyed by path, modification time and size of the
+ * file, as well as the size of the preview. Once the cache grows too large,
+ * the previews used least recently are removed.
+ */
+class PreviewLoader : public QObject, public QRunnable
+{
+    Q_OBJECT
+    public:
+        PreviewLoader(const QStringList &paths, const QSize &size, QObject *parent = nullptr);
+        void run() override;
+
+        static QString cacheFileName(const QString &path, const QSize &size);
+        static void save(const QString &path, const QSize &size, const QImage &preview);
+
+    private:
+        static QString cacheDirectory();
+        static void prune();
+
+    Q_SIGNALS:
+        void previewsLoaded(const QHash<QString, QImage> &previews, const QStringList &missing);
+
+    private:
+        QStringList m_paths;
+        QSize m_size;
+};
+
 class BackgroundListModel : public QAbstractListModel
 {
     Q_OBJECT
@@ -100,21 +131,40 @@ Q_SIGNALS:
 protected Q_SLOTS:
     void showPreview(const KFileItem &item, const QPixmap &preview);
     void previewFailed(const KFileItem &item);
+    void processPreviewRequests();
+    void previewsLoaded(const QHash<QString, QImage> &previews, const QStringList &missing);
     void sizeFound(const QString &path, const QSize &s);
     void processPaths(const QStringList &paths);
+    // Adds the wallpapers at @p paths, which must not be in the model yet
+    void appendPaths(const QStringList &paths);
 
 protected:
     QPointer<Image> m_wallpaper;
     QString m_findToken;
     QList<KPackage::Package> m_packages;
+    // Wallpapers shown for the scan in progress
+    QSet<QString> m_shownPaths;
 
 private:
     QSize bestSize(const KPackage::Package &package) const;
+    QSize previewSize() const;
+    void requestPreview(const QModelIndex &index, const QString &path);
+    void setPreviews(const QHash<QString, QPixmap> &previews);
+    QList<KPackage::Package> loadPackages(const QStringList &paths);
 
     QSet<QString> m_removableWallpapers;
     QHash<QString, QSize> m_sizeCache;
-    QHash<QPersistentModelIndex, QUrl> m_previewJobsUrls;
     KDirWatch m_dirwatch;
+
+    // Previews asked for by views since the last batch, and the ones being made
+    QHash<QString, QPersistentModelIndex> m_requestedPreviews;
+    // Tracked by path only, as the model may be reset while they're made
+    QSet<QString> m_pendingPreviews;
+    // Rows by the path their preview is made of, built on demand after rows changed
+    QMultiHash<QString, int> m_previewRows;
+    QTimer m_previewRequestTimer;
+    // Largest number of previews requested at once, roughly the number of visible cells
+    int m_visiblePreviews = 0;
     QCache<QString, QPixmap> m_imageCache;
 
     int m_screenshotSize;
@@ -135,17 +185,31 @@ public:
     static bool isAcceptableSuffix(const QString &suffix);
 
 Q_SIGNALS:
+    /**
+     * Emitted while the scan is running with the wallpapers found since the
+     * previous batch, in no particular order.
+     */
+    void backgroundsBatchFound(const QStringList &paths, const QString &token);
     void backgroundsFound(const QStringList &paths, const QString &token);
 
 protected:
     void run() override;
 
 private:
+    void scanDirectory(const QString &path);
+    void emitBatch();
+
     QStringList m_paths;
     QString m_token;
 
+    QThreadPool m_pool;
+    QMutex m_batchMutex;
+    QStringList m_batch;
+
     static QMutex s_suffixMutex;
     static QStringList s_suffixes;
+    // KPackage isn't meant to be used from several threads at once
+    static QMutex s_packageMutex;
 };
 
 #endif // BACKGROUNDLISTMODEL_H
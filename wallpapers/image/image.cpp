@@ -53,8 +53,10 @@
 #include <Plasma/PluginLoader>
 #include <qstandardpaths.h>
 #include "backgroundlistmodel.h"
+#include "backgroundindex.h"
 #include "slidemodel.h"
 #include "slidefiltermodel.h"
+#include "wallpaperimageprovider.h"
 
 #include <KPackage/PackageLoader>
 
@@ -123,6 +125,12 @@ QUrl Image::wallpaperPath() const
     return QUrl::fromLocalFile(m_wallpaperPath);
 }
 
+QString Image::wallpaperLocalPath() const
+{
+    // The same file as wallpaperPath, without a round trip through the URL in QML
+    return wallpaperPath().toLocalFile();
+}
+
 void Image::addUrl(const QString &url)
 {
     addUrl(QUrl(url), true);
@@ -274,6 +282,19 @@ void Image::setTargetSize(const QSize &size)
     }
 }
 
+bool Image::prefetchSlides() const
+{
+    return m_prefetchSlides;
+}
+
+void Image::setPrefetchSlides(bool prefetch)
+{
+    if (m_prefetchSlides != prefetch) {
+        m_prefetchSlides = prefetch;
+        emit prefetchSlidesChanged();
+    }
+}
+
 KPackage::Package *Image::package()
 {
     return &m_wallpaperPackage;
@@ -470,6 +491,7 @@ void Image::removeSlidePath(const QString &path)
 
 void Image::pathDirty(const QString& path)
 {
+    BackgroundIndex::self()->invalidate(path);
     updateDirWatch(QStringList(path));
 }
 
@@ -647,8 +669,9 @@ void Image::startSlideshow()
     }
     // populate background list
     m_timer.stop();
+    // Connect first, the slides known from the index are reported from within reload()
+    connect(m_slideshowModel, &SlideModel::done, this, &Image::backgroundsFound, Qt::UniqueConnection);
     m_slideshowModel->reload(m_slidePaths);
-    connect(m_slideshowModel, &SlideModel::done, this, &Image::backgroundsFound);
     //TODO: what would be cool: paint on the wallpaper itself a busy widget and perhaps some text
     //about loading wallpaper slideshow while the thread runs
 }
@@ -656,6 +679,7 @@ void Image::startSlideshow()
 void Image::backgroundsFound()
 {
     disconnect(m_slideshowModel, &SlideModel::done, this, 0);
+    disconnect(m_slideFilterModel, &SlideFilterModel::sortKeysFound, this, &Image::backgroundsFound);
 
     if(m_scanDirty) {
         m_scanDirty = false;
@@ -668,6 +692,9 @@ void Image::backgroundsFound()
         // no image has been found, which is quite weird... try again later (this is useful for events which
         // are not detected by KDirWatch, like a NFS directory being mounted)
         QTimer::singleShot(1000, this, &Image::startSlideshow);
+    } else if (m_slideFilterModel->sortKeysPending()) {
+        // Don't pick the first slide before the order is known
+        connect(m_slideFilterModel, &SlideFilterModel::sortKeysFound, this, &Image::backgroundsFound);
     } else {
         if (m_currentSlide == -1) {
             m_currentSlide = m_slideFilterModel->indexOf(m_wallpaper) - 1;
@@ -805,6 +832,14 @@ void Image::nextSlide()
         m_wallpaperPath = next.toLocalFile();
     }
     Q_EMIT wallpaperPathChanged();
+
+    // Have the following slide decoded by the time it is shown; after the
+    // last one the order may be reshuffled, so don't guess in random mode
+    const int following = m_currentSlide + 1 < m_slideFilterModel->rowCount() ? m_currentSlide + 1 : (m_slideshowMode == Random ? -1 : 0);
+    if (m_prefetchSlides && following >= 0 && following != m_currentSlide) {
+        const QUrl followingPath = m_slideFilterModel->index(following, 0).data(BackgroundListModel::PathRole).toUrl();
+        WallpaperImageCache::self()->prefetch(followingPath.toLocalFile(), m_targetSize);
+    }
 }
 
 void Image::openSlide()
@@ -824,6 +859,8 @@ void Image::pathCreated(const QString &path)
     if(m_slideshowModel->indexOf(path) == -1) {
         QFileInfo fileInfo(path);
         if(fileInfo.isFile() && BackgroundFinder::isAcceptableSuffix(fileInfo.suffix())) {
+            BackgroundIndex::self()->addWallpaper(path);
+            BackgroundIndex::self()->scheduleSave();
             m_slideshowModel->addBackground(path);
             if(m_slideFilterModel->rowCount() == 1) {
                 nextSlide();
@@ -834,6 +871,8 @@ void Image::pathCreated(const QString &path)
 
 void Image::pathDeleted(const QString &path)
 {
+    BackgroundIndex::self()->removePath(path);
+    BackgroundIndex::self()->scheduleSave();
     if(m_slideshowModel->indexOf(path) != -1) {
         m_slideshowModel->removeBackground(path);
         if(path == m_img) {
@@ -55,12 +55,15 @@ class Image : public QObject, public QQmlParserStatus
     Q_PROPERTY(RenderingMode renderingMode READ renderingMode WRITE setRenderingMode NOTIFY renderingModeChanged)
     Q_PROPERTY(SlideshowMode slideshowMode READ slideshowMode WRITE setSlideshowMode NOTIFY slideshowModeChanged)
     Q_PROPERTY(QUrl wallpaperPath READ wallpaperPath NOTIFY wallpaperPathChanged)
+    Q_PROPERTY(QString wallpaperLocalPath READ wallpaperLocalPath NOTIFY wallpaperPathChanged)
     Q_PROPERTY(QAbstractItemModel *wallpaperModel READ wallpaperModel CONSTANT)
     Q_PROPERTY(QAbstractItemModel *slideFilterModel READ slideFilterModel CONSTANT)
     Q_PROPERTY(int slideTimer READ slideTimer WRITE setSlideTimer NOTIFY slideTimerChanged)
     Q_PROPERTY(QStringList usersWallpapers READ usersWallpapers WRITE setUsersWallpapers NOTIFY usersWallpapersChanged)
     Q_PROPERTY(QStringList slidePaths READ slidePaths WRITE setSlidePaths NOTIFY slidePathsChanged)
     Q_PROPERTY(QSize targetSize READ targetSize WRITE setTargetSize NOTIFY targetSizeChanged)
+    // Whether the next slide should be decoded ahead of time, only useful when it is shown through the image provider
+    Q_PROPERTY(bool prefetchSlides READ prefetchSlides WRITE setPrefetchSlides NOTIFY prefetchSlidesChanged)
     Q_PROPERTY(QString photosPath READ photosPath CONSTANT)
     Q_PROPERTY(QStringList uncheckedSlides READ uncheckedSlides WRITE setUncheckedSlides NOTIFY uncheckedSlidesChanged)
 
@@ -85,6 +88,7 @@ class Image : public QObject, public QQmlParserStatus
         ~Image() override;
 
         QUrl wallpaperPath() const;
+        QString wallpaperLocalPath() const;
 
         //this is for QML use
         Q_INVOKABLE void addUrl(const QString &url);
@@ -110,6 +114,9 @@ class Image : public QObject, public QQmlParserStatus
         QSize targetSize() const;
         void setTargetSize(const QSize &size);
 
+        bool prefetchSlides() const;
+        void setPrefetchSlides(bool prefetch);
+
         KPackage::Package *package();
 
         QAbstractItemModel* wallpaperModel();
@@ -145,6 +152,7 @@ class Image : public QObject, public QQmlParserStatus
         void renderingModeChanged();
         void slideshowModeChanged();
         void targetSizeChanged();
+        void prefetchSlidesChanged();
         void slideTimerChanged();
         void usersWallpapersChanged();
         void slidePathsChanged();
@@ -189,6 +197,7 @@ class Image : public QObject, public QQmlParserStatus
         KDirWatch *m_dirWatch;
         bool m_scanDirty;
         QSize m_targetSize;
+        bool m_prefetchSlides = false;
 
         RenderingMode m_mode;
         SlideshowMode m_slideshowMode;
@@ -29,6 +29,13 @@ QQC2.StackView {
     id: root
 
     readonly property string modelImage: imageWallpaper.wallpaperPath
+    // Decoded at screen size and shared between screens; padded and tiled
+    // images are shown at their own size, so load them as they are
+    readonly property bool useImageProvider: fillMode !== Image.Pad && fillMode !== Image.Tile
+                                             && fillMode !== Image.TileVertically && fillMode !== Image.TileHorizontally
+    readonly property string imageSource: (imageWallpaper.wallpaperLocalPath === "" || !useImageProvider)
+                                          ? modelImage
+                                          : "image://wallpaperimage/" + encodeURIComponent(imageWallpaper.wallpaperLocalPath)
     readonly property string configuredImage: wallpaper.configuration.Image
     readonly property int fillMode: wallpaper.configuration.FillMode
     readonly property string configColor: wallpaper.configuration.Color
@@ -74,6 +81,7 @@ QQC2.StackView {
         //the oneliner of difference between image and slideshow wallpapers
         renderingMode: (wallpaper.pluginName === "org.kde.image") ? Wallpaper.Image.SingleImage : Wallpaper.Image.SlideShow
         targetSize: root.sourceSize
+        prefetchSlides: root.useImageProvider
         slidePaths: wallpaper.configuration.SlidePaths
         slideTimer: wallpaper.configuration.SlideInterval
         slideshowMode: wallpaper.configuration.SlideshowMode
@@ -92,7 +100,7 @@ QQC2.StackView {
 
     function loadImage() {
         var isFirst = (root.currentItem == undefined);
-        var pendingImage = baseImage.createObject(root, { "source": root.modelImage,
+        var pendingImage = baseImage.createObject(root, { "source": root.imageSource,
                         "fillMode": root.fillMode,
                         "sourceSize": root.sourceSize,
                         "color": root.configColor,
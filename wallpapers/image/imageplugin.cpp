@@ -19,6 +19,7 @@
 
 #include "imageplugin.h"
 #include "image.h"
+#include "wallpaperimageprovider.h"
 #include <QQmlContext>
 
 
@@ -30,5 +31,15 @@ void ImagePlugin::registerTypes(const char *uri)
     qmlRegisterType<QAbstractItemModel>();
 }
 
+void ImagePlugin::initializeEngine(QQmlEngine *engine, const char *uri)
+{
+    Q_UNUSED(uri)
+
+    // All screens share the engine, and through the provider the decoded images
+    if (!engine->imageProvider(QStringLiteral("wallpaperimage"))) {
+        engine->addImageProvider(QStringLiteral("wallpaperimage"), new WallpaperImageProvider);
+    }
+}
+
 
 
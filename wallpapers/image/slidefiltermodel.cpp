@@ -23,8 +23,26 @@
 
 #include <QRandomGenerator>
 #include <QFileInfo>
+#include <QThreadPool>
 
 #include <algorithm>
+#include <numeric>
+
+ModifiedTimeFinder::ModifiedTimeFinder(const QStringList &paths, QObject *parent)
+    : QObject(parent),
+      m_paths(paths)
+{
+}
+
+void ModifiedTimeFinder::run()
+{
+    QHash<QString, qint64> modifiedTimes;
+    modifiedTimes.reserve(m_paths.count());
+    for (const QString &path : qAsConst(m_paths)) {
+        modifiedTimes.insert(path, QFileInfo(path).lastModified().toMSecsSinceEpoch());
+    }
+    Q_EMIT modifiedTimesFound(modifiedTimes);
+}
 
 SlideFilterModel::SlideFilterModel(QObject* parent)
     : QSortFilterProxyModel{parent}
@@ -48,27 +66,26 @@ void SlideFilterModel::setSourceModel(QAbstractItemModel *sourceModel)
         disconnect(this->sourceModel(), nullptr, this, nullptr);
     }
     QSortFilterProxyModel::setSourceModel(sourceModel);
-    if (m_SortingMode == Image::Random && !m_usedInConfig) {
-        buildRandomOrder();
-    }
+    buildRandomOrder();
+    buildModifiedKeys();
     if(sourceModel) {
-        connect(sourceModel, &QAbstractItemModel::modelReset, this, &SlideFilterModel::buildRandomOrder);
-        connect(sourceModel, &QAbstractItemModel::rowsInserted, this, [this] {
-            if (m_SortingMode !=  Image::Random || m_usedInConfig) {
-                return;
-            }
-            const int old_count = m_randomOrder.size();
-            m_randomOrder.resize(this->sourceModel()->rowCount());
-            std::iota(m_randomOrder.begin() + old_count, m_randomOrder.end(), old_count);
-            std::random_shuffle(m_randomOrder.begin() + old_count, m_randomOrder.end());
+        connect(sourceModel, &QAbstractItemModel::modelReset, this, [this] {
+            // Look the times up again, files may have been changed in place
+            m_modifiedTimes.clear();
+            buildRandomOrder();
+            buildModifiedKeys();
         });
-        connect(sourceModel, &QAbstractItemModel::rowsRemoved, this, [this] {
-            if (m_SortingMode !=  Image::Random || m_usedInConfig) {
-                return;
-            }
-            m_randomOrder.erase(std::remove_if(m_randomOrder.begin(), m_randomOrder.end(), [this] (const int v) {
-                return v >= this->sourceModel()->rowCount();
-            }), m_randomOrder.end());
+        // The proxy may sort the new rows before rowsInserted reaches us, make room for them beforehand
+        connect(sourceModel, &QAbstractItemModel::rowsAboutToBeInserted, this, [this] (const QModelIndex &, int first, int last) {
+            insertRandomRanks(first, last - first + 1);
+            m_modifiedKeys.insert(first, last - first + 1, -1);
+        });
+        connect(sourceModel, &QAbstractItemModel::rowsInserted, this, [this] (const QModelIndex &, int first, int last) {
+            updateModifiedKeys(first, last);
+        });
+        connect(sourceModel, &QAbstractItemModel::rowsRemoved, this, [this] (const QModelIndex &, int first, int last) {
+            m_randomRanks.remove(first, last - first + 1);
+            m_modifiedKeys.remove(first, last - first + 1);
         });
     }
 }
@@ -80,23 +97,15 @@ bool SlideFilterModel::lessThan(const QModelIndex& source_left, const QModelInde
             if (m_usedInConfig) {
                 return source_left.row() < source_right.row();
             }
-            return m_randomOrder.indexOf(source_left.row()) < m_randomOrder.indexOf(source_right.row());
+            return m_randomRanks.value(source_left.row()) < m_randomRanks.value(source_right.row());
         case Image::Alphabetical:
             return QSortFilterProxyModel::lessThan(source_left, source_right);
         case Image::AlphabeticalReversed:
             return !QSortFilterProxyModel::lessThan(source_left, source_right);
         case Image::Modified: // oldest first
-        {
-            QFileInfo f1(source_left.data(BackgroundListModel::PathRole).toUrl().toLocalFile());
-            QFileInfo f2(source_right.data(BackgroundListModel::PathRole).toUrl().toLocalFile());
-            return f1.lastModified() < f2.lastModified();
-        }
+            return m_modifiedKeys.value(source_left.row(), -1) < m_modifiedKeys.value(source_right.row(), -1);
         case Image::ModifiedReversed: // newest first
-        {
-            QFileInfo f1(source_left.data(BackgroundListModel::PathRole).toUrl().toLocalFile());
-            QFileInfo f2(source_right.data(BackgroundListModel::PathRole).toUrl().toLocalFile());
-            return !(f1.lastModified() < f2.lastModified());
-        }
+            return !(m_modifiedKeys.value(source_left.row(), -1) < m_modifiedKeys.value(source_right.row(), -1));
         }
         Q_UNREACHABLE();
 }
@@ -107,13 +116,16 @@ void SlideFilterModel::setSortingMode(Image::SlideshowMode mode)
     if (m_SortingMode == Image::Random && !m_usedInConfig) {
         buildRandomOrder();
     }
+    if (usesModifiedTime()) {
+        buildModifiedKeys();
+    }
     QSortFilterProxyModel::invalidate();
 }
 
 void SlideFilterModel::invalidate()
 {
     if (m_SortingMode == Image::Random && !m_usedInConfig) {
-        std::random_shuffle(m_randomOrder.begin(), m_randomOrder.end());
+        std::random_shuffle(m_randomRanks.begin(), m_randomRanks.end());
     }
     QSortFilterProxyModel::invalidate();
 }
@@ -135,11 +147,104 @@ void SlideFilterModel::openContainingFolder(int rowIndex)
     static_cast<SlideModel*>(sourceModel())->openContainingFolder(sourceIndex.row());
 }
 
+bool SlideFilterModel::sortKeysPending() const
+{
+    return usesModifiedTime() && (m_findingModifiedTimes || !m_pendingModifiedPaths.isEmpty());
+}
+
+bool SlideFilterModel::usesModifiedTime() const
+{
+    return m_SortingMode == Image::Modified || m_SortingMode == Image::ModifiedReversed;
+}
+
 void SlideFilterModel::buildRandomOrder()
 {
+    m_randomRanks.clear();
+    if (sourceModel()) {
+        insertRandomRanks(0, sourceModel()->rowCount());
+    }
+}
+
+void SlideFilterModel::insertRandomRanks(int first, int count)
+{
+    // New rows are shown after the existing ones, in random order among themselves
+    int nextRank = 0;
+    for (int rank : qAsConst(m_randomRanks)) {
+        nextRank = qMax(nextRank, rank + 1);
+    }
+
+    QVector<int> ranks(count);
+    std::iota(ranks.begin(), ranks.end(), nextRank);
+    std::random_shuffle(ranks.begin(), ranks.end());
+
+    first = qBound(0, first, m_randomRanks.count());
+    m_randomRanks.insert(first, count, 0);
+    std::copy(ranks.cbegin(), ranks.cend(), m_randomRanks.begin() + first);
+}
+
+void SlideFilterModel::buildModifiedKeys()
+{
+    m_modifiedKeys.clear();
     if (sourceModel()) {
-        m_randomOrder.resize(sourceModel()->rowCount());
-        std::iota(m_randomOrder.begin(), m_randomOrder.end(), 0);
-        std::random_shuffle(m_randomOrder.begin(), m_randomOrder.end());
+        m_modifiedKeys.fill(-1, sourceModel()->rowCount());
+        updateModifiedKeys(0, sourceModel()->rowCount() - 1);
+    }
+}
+
+void SlideFilterModel::updateModifiedKeys(int first, int last)
+{
+    if (!usesModifiedTime()) {
+        return;
+    }
+
+    for (int i = first; i <= last && i < m_modifiedKeys.count(); ++i) {
+        const QString path = sourceModel()->index(i, 0).data(BackgroundListModel::PathRole).toUrl().toLocalFile();
+        const auto it = m_modifiedTimes.constFind(path);
+        if (it != m_modifiedTimes.constEnd()) {
+            m_modifiedKeys[i] = *it;
+        } else {
+            m_pendingModifiedPaths << path;
+        }
+    }
+
+    findModifiedTimes();
+}
+
+void SlideFilterModel::findModifiedTimes()
+{
+    if (m_findingModifiedTimes || m_pendingModifiedPaths.isEmpty()) {
+        return;
+    }
+
+    ModifiedTimeFinder *finder = new ModifiedTimeFinder(m_pendingModifiedPaths);
+    connect(finder, &ModifiedTimeFinder::modifiedTimesFound, this, &SlideFilterModel::modifiedTimesFound);
+    QThreadPool::globalInstance()->start(finder);
+
+    m_pendingModifiedPaths.clear();
+    m_findingModifiedTimes = true;
+}
+
+void SlideFilterModel::modifiedTimesFound(const QHash<QString, qint64> &modifiedTimes)
+{
+    m_findingModifiedTimes = false;
+
+    for (auto it = modifiedTimes.constBegin(); it != modifiedTimes.constEnd(); ++it) {
+        m_modifiedTimes.insert(it.key(), it.value());
+    }
+
+    if (sourceModel() && usesModifiedTime()) {
+        for (int i = 0; i < m_modifiedKeys.count(); ++i) {
+            if (m_modifiedKeys.at(i) == -1) {
+                const QString path = sourceModel()->index(i, 0).data(BackgroundListModel::PathRole).toUrl().toLocalFile();
+                m_modifiedKeys[i] = m_modifiedTimes.value(path, -1);
+            }
+        }
+        QSortFilterProxyModel::invalidate();
+    }
+
+    findModifiedTimes();
+
+    if (!sortKeysPending()) {
+        Q_EMIT sortKeysFound();
     }
 }
@@ -21,9 +21,26 @@
 
 #include <image.h>
 
+#include <QHash>
+#include <QRunnable>
 #include <QSortFilterProxyModel>
+#include <QStringList>
 #include <QVector>
 
+class ModifiedTimeFinder : public QObject, public QRunnable
+{
+    Q_OBJECT
+    public:
+        explicit ModifiedTimeFinder(const QStringList &paths, QObject *parent = nullptr);
+        void run() override;
+
+    Q_SIGNALS:
+        void modifiedTimesFound(const QHash<QString, qint64> &modifiedTimes);
+
+    private:
+        QStringList m_paths;
+};
+
 class SlideFilterModel : public QSortFilterProxyModel {
 
     Q_OBJECT
@@ -42,13 +59,34 @@ public:
     Q_INVOKABLE int indexOf(const QString& path);
     Q_INVOKABLE void openContainingFolder(int rowIndex);
 
+    /**
+     * Whether sort keys of some rows are still being looked up, in which
+     * case the order isn't final yet. sortKeysFound() is emitted once they are in.
+     */
+    bool sortKeysPending() const;
+
 Q_SIGNALS:
     void usedInConfigChanged();
+    void sortKeysFound();
 
 private:
+    bool usesModifiedTime() const;
     void buildRandomOrder();
+    void insertRandomRanks(int first, int count);
+    void buildModifiedKeys();
+    void updateModifiedKeys(int first, int last);
+    void findModifiedTimes();
+    void modifiedTimesFound(const QHash<QString, qint64> &modifiedTimes);
+
+    // Sort keys indexed by source row, so sorting needs neither I/O nor lookups
+    QVector<int> m_randomRanks;
+    QVector<qint64> m_modifiedKeys;
+
+    // Modification times of the wallpapers, looked up in the background
+    QHash<QString, qint64> m_modifiedTimes;
+    QStringList m_pendingModifiedPaths;
+    bool m_findingModifiedTimes = false;
 
-    QVector<int> m_randomOrder;
     Image::SlideshowMode m_SortingMode;
     bool m_usedInConfig;
 };
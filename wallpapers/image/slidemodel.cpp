@@ -18,6 +18,8 @@
 
 #include "slidemodel.h"
 
+#include "backgroundindex.h"
+
 void SlideModel::reload(const QStringList &selected)
 {
     if (!m_packages.isEmpty()) {
@@ -33,9 +35,36 @@ void SlideModel::reload(const QStringList &selected)
 void SlideModel::addDirs(const QStringList &selected)
 {
     BackgroundFinder *finder = new BackgroundFinder(m_wallpaper.data(), selected);
+    connect(finder, &BackgroundFinder::backgroundsBatchFound, this, &SlideModel::backgroundsBatchFound);
     connect(finder, &BackgroundFinder::backgroundsFound, this, &SlideModel::backgroundsFound);
     m_findToken = finder->token();
-    finder->start(); 
+    m_shownPaths.clear();
+
+    // Show what was found last time right away, the scan only brings it up to date
+    const QStringList indexedPaths = BackgroundIndex::self()->wallpapers(selected);
+    if (!indexedPaths.isEmpty()) {
+        processPaths(indexedPaths);
+        m_shownPaths = QSet<QString>(indexedPaths.constBegin(), indexedPaths.constEnd());
+        emit done();
+    }
+
+    finder->start();
+}
+
+void SlideModel::backgroundsBatchFound(const QStringList &paths, const QString &token)
+{
+    if (token != m_findToken) {
+        return;
+    }
+
+    QStringList newPaths;
+    for (const QString &path : paths) {
+        if (!m_shownPaths.contains(path)) {
+            m_shownPaths.insert(path);
+            newPaths << path;
+        }
+    }
+    appendPaths(newPaths);
 }
 
 void SlideModel::backgroundsFound(const QStringList& paths, const QString& token)
@@ -43,7 +72,12 @@ void SlideModel::backgroundsFound(const QStringList& paths, const QString& token
      if (token != m_findToken) {
         return;
     }
-    processPaths(paths);
+    // The batches only ever add, reset the model if something went away since
+    // it was populated from the index
+    if (QSet<QString>(paths.constBegin(), paths.constEnd()) != m_shownPaths) {
+        processPaths(paths);
+    }
+    m_shownPaths.clear();
     emit done();
 }
 
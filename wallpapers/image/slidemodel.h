@@ -33,10 +33,17 @@ public:
     QHash<int, QByteArray> roleNames() const override;
 
 Q_SIGNALS:
+    /**
+     * Emitted when the slides are ready. When the directories were indexed
+     * before, this is emitted once for the indexed slides from within
+     * reload() or addDirs(), and once more when the scan brought them up to
+     * date.
+     */
     void done();
 
 private Q_SLOTS:
     void removeBackgrounds(const QStringList &paths, const QString &token);
+    void backgroundsBatchFound(const QStringList &paths, const QString &token);
     void backgroundsFound(const QStringList &paths, const QString &token);
 };
 
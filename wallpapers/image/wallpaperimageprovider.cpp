@@ -0,0 +1,155 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "wallpaperimageprovider.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QtMath>
+#include <QUrl>
+
+// Enough for the current and the next slide of a few 4K screens, in KiB
+static const int MAX_CACHED_IMAGES_SIZE = 160 * 1024;
+
+Q_GLOBAL_STATIC(WallpaperImageCache, s_wallpaperImageCache)
+
+WallpaperImageCache::WallpaperImageCache()
+{
+    m_images.setMaxCost(MAX_CACHED_IMAGES_SIZE);
+}
+
+WallpaperImageCache *WallpaperImageCache::self()
+{
+    return s_wallpaperImageCache();
+}
+
+QString WallpaperImageCache::cacheKey(const QString &path, const QSize &targetSize)
+{
+    // A changed file must not be served from the cache
+    const qint64 modified = QFileInfo(path).lastModified().toMSecsSinceEpoch();
+    return QStringLiteral("%1 %2 %3x%4").arg(path).arg(modified).arg(targetSize.width()).arg(targetSize.height());
+}
+
+QImage WallpaperImageCache::decode(const QString &path, const QSize &targetSize)
+{
+    QImageReader reader(path);
+    reader.setAutoTransform(true);
+
+    QSize size = reader.size();
+    if (size.isValid() && targetSize.width() > 0 && targetSize.height() > 0) {
+        // The scaled size applies before the image is rotated
+        QSize target = targetSize;
+        if (reader.transformation() & QImageIOHandler::TransformationRotate90) {
+            target.transpose();
+        }
+
+        // Cover the target, as it may be cropped to fill the screen
+        const qreal scale = qMax(qreal(target.width()) / size.width(), qreal(target.height()) / size.height());
+        if (scale < 1) {
+            reader.setScaledSize(QSize(qCeil(size.width() * scale), qCeil(size.height() * scale)));
+        }
+    }
+
+    return reader.read();
+}
+
+QImage WallpaperImageCache::image(const QString &path, const QSize &targetSize)
+{
+    const QString key = cacheKey(path, targetSize);
+
+    QMutexLocker lock(&m_mutex);
+
+    // Another screen or a prefetch may be decoding the same image already
+    while (m_decoding.contains(key)) {
+        m_decoded.wait(&m_mutex);
+    }
+
+    if (QImage *image = m_images.object(key)) {
+        return *image;
+    }
+
+    m_decoding.insert(key);
+    lock.unlock();
+
+    const QImage image = decode(path, targetSize);
+
+    lock.relock();
+    m_decoding.remove(key);
+    if (!image.isNull()) {
+        m_images.insert(key, new QImage(image), qMax<qsizetype>(1, image.sizeInBytes() / 1024));
+    }
+    m_decoded.wakeAll();
+
+    return image;
+}
+
+void WallpaperImageCache::prefetch(const QString &path, const QSize &targetSize)
+{
+    if (path.isEmpty()) {
+        return;
+    }
+
+    QThreadPool::globalInstance()->start([this, path, targetSize] {
+        image(path, targetSize);
+    });
+}
+
+class WallpaperImageResponse : public QQuickImageResponse, public QRunnable
+{
+public:
+    WallpaperImageResponse(const QString &path, const QSize &requestedSize)
+        : m_path(path)
+        , m_requestedSize(requestedSize)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override
+    {
+        m_image = WallpaperImageCache::self()->image(m_path, m_requestedSize);
+        if (m_image.isNull()) {
+            m_errorString = QStringLiteral("Failed to load %1").arg(m_path);
+        }
+        emit finished();
+    }
+
+    QQuickTextureFactory *textureFactory() const override
+    {
+        return QQuickTextureFactory::textureFactoryForImage(m_image);
+    }
+
+    QString errorString() const override
+    {
+        return m_errorString;
+    }
+
+private:
+    QString m_path;
+    QSize m_requestedSize;
+    QImage m_image;
+    QString m_errorString;
+};
+
+QQuickImageResponse *WallpaperImageProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+    auto *response = new WallpaperImageResponse(QUrl::fromPercentEncoding(id.toUtf8()), requestedSize);
+    QThreadPool::globalInstance()->start(response);
+    return response;
+}
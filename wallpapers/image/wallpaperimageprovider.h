@@ -0,0 +1,71 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef WALLPAPERIMAGEPROVIDER_H
+#define WALLPAPERIMAGEPROVIDER_H
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QQuickAsyncImageProvider>
+#include <QSet>
+#include <QWaitCondition>
+
+/**
+ * Wallpaper images decoded at the size they are shown at, shared by all
+ * screens and wallpaper instances of the process.
+ */
+class WallpaperImageCache
+{
+public:
+    WallpaperImageCache();
+
+    static WallpaperImageCache *self();
+
+    /**
+     * Returns the image at @p path, downscaled while decoding to cover
+     * @p targetSize. Blocks until it is decoded, so don't call this from
+     * the GUI thread.
+     */
+    QImage image(const QString &path, const QSize &targetSize);
+
+    /**
+     * Decodes the image at @p path in the background, so it is ready
+     * when it's shown.
+     */
+    void prefetch(const QString &path, const QSize &targetSize);
+
+private:
+    static QString cacheKey(const QString &path, const QSize &targetSize);
+    static QImage decode(const QString &path, const QSize &targetSize);
+
+    QMutex m_mutex;
+    QWaitCondition m_decoded;
+    QCache<QString, QImage> m_images;
+    QSet<QString> m_decoding;
+};
+
+/**
+ * Serves "image://wallpaperimage/<path>" from the WallpaperImageCache,
+ * using the sourceSize of the Image item as target size.
+ */
+class WallpaperImageProvider : public QQuickAsyncImageProvider
+{
+public:
+    QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+};
+
+#endif // WALLPAPERIMAGEPROVIDER_H